@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "petricks.hpp"
+
+// maps a dll under each allocation policy through a provider that records what is asked of VirtualAlloc,
+// once with large pages available and once refusing them
+
+using namespace pe::runtime;
+using pe::runtime::loader::memory_module;
+namespace alloc_policy = pe::runtime::loader::alloc_policy;
+
+struct recording_api : winapi_default {
+    static bool refuse_large;
+    static std::vector<pe::u32> requests;
+
+    static void* VirtualAlloc(void* lpAddress, size_t dwSize, pe::u32 flAllocationType, pe::u32 flProtect) {
+        requests.push_back(flAllocationType);
+        if (refuse_large && (flAllocationType & mem::large_pages)) { return nullptr; }
+        return winapi_default::VirtualAlloc(lpAddress, dwSize, flAllocationType, flProtect);
+    }
+};
+bool recording_api::refuse_large = false;
+std::vector<pe::u32> recording_api::requests;
+
+std::vector<char> read_file(const char* name) {
+    std::vector<char> file_buf;
+    std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return file_buf; }
+    file_buf.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(file_buf.data(), file_buf.size());
+    return file_buf;
+}
+
+bool check(const char* what, bool ok) {
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) { printf("usage: %s <dll>\n", argv[0]); return 1; }
+    auto image = read_file(argv[1]);
+    if (image.empty()) { printf("cannot read %s\n", argv[1]); return 1; }
+    bool ok = true;
+
+    for (int refuse = 0; refuse < 2; ++refuse) {
+        printf("large pages %s:\n", refuse ? "refused" : "available");
+        recording_api::refuse_large = refuse != 0;
+
+        recording_api::requests.clear();
+        memory_module<recording_api> plain;
+        ok &= check("normal policy maps", plain.map(image.data()) == memory_module<recording_api>::errc::ok);
+        ok &= check("normal policy never asks for large pages", !(recording_api::requests.front() & mem::large_pages));
+        plain.close();
+
+        recording_api::requests.clear();
+        memory_module<recording_api> big({}, alloc_policy::large_pages | alloc_policy::prefault);
+        ok &= check("large page policy maps", big.map(image.data()) == memory_module<recording_api>::errc::ok);
+        pe::u32 first = recording_api::requests.front();
+        ok &= check("first request is reserve|commit|large_pages", first == (mem::reserve | mem::commit | mem::large_pages));
+        if (refuse) {
+            ok &= check("falls back to normal pages", !big.large_pages() && recording_api::requests.size() > 1 && !(recording_api::requests[1] & mem::large_pages));
+        } else {
+            // the host may still have none to give, e.g. without SeLockMemoryPrivilege or transparent huge pages
+            printf("  %-44s %s\n", "got large pages", big.large_pages() ? "yes" : "no");
+            if (big.large_pages()) { ok &= check("no further requests", recording_api::requests.size() == 1); }
+        }
+        big.close();
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+/**
+ *  Resolves API set contracts against a schema captured from a Windows machine, or captures the one of this process.
+ *  usage: apiset <schema> <contract> [importer]
+ *         apiset --capture <schema>      (Windows 8.1 and later)
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "petricks/rt-reflect.hpp"
+
+int main(int argc, char** argv) {
+    using namespace pe::runtime::reflect;
+    if (argc == 3 && std::string(argv[1]) == "--capture") {
+#if defined(_WIN32) || defined(_WIN64)
+        auto schema = static_cast<const pe::u32*>(get_current_teb()->ProcessEnvironmentBlock->ApiSetMap);
+        if (!schema || schema[0] < 4) { fprintf(stderr, "no schema of known size in this process\n"); return 1; }
+        std::ofstream out(argv[2], std::ios::binary);
+        out.write(reinterpret_cast<const char*>(schema), schema[1]);
+        printf("schema version %u, %u bytes\n", schema[0], schema[1]);
+        return 0;
+#else
+        fprintf(stderr, "capturing needs Windows\n");
+        return 1;
+#endif
+    }
+    if (argc < 3) { fprintf(stderr, "usage: %s <schema> <contract> [importer]\n       %s --capture <schema>\n", argv[0], argv[0]); return 1; }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    std::vector<char> schema((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    api_set_map map;
+    if (!map.parse(schema.data(), schema.size())) { fprintf(stderr, "%s: not an API set schema of version 2, 4 or 6\n", argv[1]); return 1; }
+    printf("schema version %u, %zu contracts\n", map.version(), map.size());
+    auto host = map.resolve(argv[2], argc > 3 ? argv[3] : nullptr);
+    if (!host.size()) { printf("%s: no host\n", argv[2]); return 1; }
+    printf("%s -> %s\n", argv[2], host.data());
+    return 0;
+}
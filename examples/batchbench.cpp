@@ -0,0 +1,50 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <vector>
+#include "petricks.hpp"
+
+// opens the same image many times, one after another and then through batch_loader
+
+using pe::runtime::loader::memory_module;
+using pe::runtime::loader::batch_loader;
+
+std::vector<char> read_file(const char* name) {
+    std::vector<char> file_buf;
+    std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return file_buf; }
+    file_buf.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(file_buf.data(), file_buf.size());
+    return file_buf;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) { printf("usage: %s <dll> [modules] [threads]\n", argv[0]); return 1; }
+    auto image = read_file(argv[1]);
+    if (image.empty()) { printf("cannot read %s\n", argv[1]); return 1; }
+    size_t count = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200;
+    size_t threads = argc > 3 ? strtoul(argv[3], nullptr, 10) : std::thread::hardware_concurrency();
+
+    std::vector<memory_module<>> serial(count);
+    auto start = std::chrono::steady_clock::now();
+    for (auto& mod : serial) { mod.open(image.data()); }
+    auto serial_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<memory_module<>> batched(count);
+    start = std::chrono::steady_clock::now();
+    {
+        batch_loader<> loader(threads);
+        std::vector<std::future<memory_module<>::errc>> results;
+        for (auto& mod : batched) { results.push_back(loader.load(mod, image.data())); }
+        for (auto& result : results) {
+            if (result.get() != memory_module<>::errc::ok) { printf("open failed\n"); return 1; }
+        }
+    }
+    auto batch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%zu modules: serial %.2f ms, batch on %zu threads %.2f ms\n", count, serial_ms, threads, batch_ms);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <vector>
+#include "petricks.hpp"
+
+// maps a dll and compares CFG target lookups through binary search and through the bitmap
+
+using pe::runtime::loader::memory_module;
+using pe::image::guard_cf_targets;
+
+std::vector<char> read_file(const char* name) {
+    std::vector<char> file_buf;
+    std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return file_buf; }
+    file_buf.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(file_buf.data(), file_buf.size());
+    return file_buf;
+}
+
+template <typename FuncT>
+double seconds(FuncT&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) { printf("usage: %s <dll> [lookups]\n", argv[0]); return 1; }
+    auto image = read_file(argv[1]);
+    if (image.empty()) { printf("cannot read %s\n", argv[1]); return 1; }
+    size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000000;
+
+    memory_module<> mod;
+    if (mod.map_sections(image.data()) != memory_module<>::errc::ok) { printf("cannot map %s\n", argv[1]); return 1; }
+    mod.relocate();
+    guard_cf_targets targets(mod.base_addr());
+    if (!targets.table().size()) { printf("no GuardCFFunctionTable\n"); return 1; }
+
+    // half of the probes are targets, the others are 16-byte aligned addresses that may or may not be
+    auto base = static_cast<const char*>(mod.base_addr());
+    std::mt19937 rng(1);
+    std::vector<const void*> probes(lookups);
+    for (auto& probe : probes) {
+        pe::u32 rva = (rng() & 1) ? targets.table().rva_at(rng() % targets.table().size()) : pe::u32(rng() % targets.table().rva_at(targets.table().size() - 1)) & ~15u;
+        probe = base + rva;
+    }
+
+    size_t found = 0;
+    double search = seconds([&] { for (auto probe : probes) { found += targets.contains(probe); } });
+    double build = seconds([&] { targets.build_bitmap(); });
+    size_t found_bitmap = 0;
+    double bitmap = seconds([&] { for (auto probe : probes) { found_bitmap += targets.contains(probe); } });
+
+    printf("%zu targets, %zu bytes of bitmap built in %.2f ms\n", targets.table().size(), targets.bitmap().memory(), build * 1e3);
+    printf("binary search: %6.2f ns per lookup\n", search / lookups * 1e9);
+    printf("bitmap:        %6.2f ns per lookup%s\n", bitmap / lookups * 1e9, found == found_bitmap ? "" : " (MISMATCH)");
+    return found == found_bitmap ? 0 : 1;
+}
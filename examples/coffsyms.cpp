@@ -0,0 +1,45 @@
+/**
+ *  Finds which of the given object files or images define or reference a symbol.
+ *  usage: coffsyms <symbol> <file>...
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "petricks/coff.hpp"
+
+int main(int argc, char** argv) {
+    if (argc < 3) { fprintf(stderr, "usage: %s <symbol> <file>...\n", argv[0]); return 1; }
+    using namespace pe::image;
+    std::vector<std::vector<char>> files;
+    files.reserve(argc - 2);
+    symbol_name_index index;
+    std::vector<const char*> names;
+    for (int i = 2; i < argc; ++i) {
+        std::ifstream in(argv[i], std::ios::binary);
+        files.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        auto view = symbol_table_view::of(files.back().data(), files.back().size());
+        if (!view) { fprintf(stderr, "%s: no COFF symbol table\n", argv[i]); continue; }
+        index.add(view);
+        names.push_back(argv[i]);
+    }
+    printf("%zu external symbols in %zu files\n", index.size(), index.file_count());
+    index.find(argv[1], [&](const symbol_name_index::match& found) {
+        auto& view = index.file(found.file);
+        auto section = view.section_of(*found.record);
+        if (section) {
+            auto name = view.section_name_of(*section);
+            printf("%s: defined in %.*s at +0x%x\n", names[found.file], int(name.size()), name.data(), found.record->Value);
+        } else if (found.record->SectionNumber == symbol_section::undefined && found.record->Value) {
+            printf("%s: common, %u bytes\n", names[found.file], found.record->Value);
+        } else if (found.record->SectionNumber == symbol_section::undefined) {
+            printf("%s: referenced\n", names[found.file]);
+        } else {
+            printf("%s: absolute 0x%x\n", names[found.file], found.record->Value);
+        }
+        return true;
+    });
+    return 0;
+}
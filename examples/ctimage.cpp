@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <vector>
+#include "petricks/ct-image.hpp"
+
+// parses an embedded image at compile time, then loads it into a buffer with nothing left to parse
+
+#ifdef PETRICKS_ENABLE_CT_IMAGE
+using namespace pe;
+
+// a tiny image built in a constant expression, standing in for an embedded dll:
+// one section with a pointer to relocate, three exports and one of them pointing at the value 42
+constexpr void put(std::array<u8, 0x400>& file, size_t offset, u64 value, size_t size) {
+    for (size_t i = 0; i < size; ++i) { file[offset + i] = u8(value >> (i * 8)); }
+}
+constexpr std::array<u8, 0x400> build_image() {
+    std::array<u8, 0x400> file = {};
+    const bool is64 = sizeof(void*) == 8;
+    const u64 image_base = is64 ? 0x180000000ull : 0x10000000ull;
+    const size_t nthdr = 0x40, opthdr = nthdr + offsetof(image::nt_headers, OptionalHeader);
+    const size_t opthdr_size = is64 ? sizeof(image::optional_header64) : sizeof(image::optional_header32);
+    const size_t dirs = opthdr + (is64 ? offsetof(image::optional_header64, DataDirectory) : offsetof(image::optional_header32, DataDirectory));
+    const size_t sechdr = opthdr + opthdr_size, raw = 0x200;
+    auto at = [](u32 rva) { return size_t(rva - 0x1000 + 0x200); };
+
+    put(file, 0, image::dos_signature, 2);
+    put(file, offsetof(image::dos_header, e_lfanew), nthdr, 4);
+    put(file, nthdr, image::nt_signature, 4);
+    put(file, nthdr + 4 + offsetof(image::file_header, Machine), u16(image::file_machine::local), 2);
+    put(file, nthdr + 4 + offsetof(image::file_header, NumberOfSections), 1, 2);
+    put(file, nthdr + 4 + offsetof(image::file_header, SizeOfOptionalHeader), opthdr_size, 2);
+    put(file, opthdr, is64 ? image::nt_optional_hdr64_magic : image::nt_optional_hdr32_magic, 2);
+    if (is64) { put(file, opthdr + offsetof(image::optional_header64, ImageBase), image_base, 8); }
+    else { put(file, opthdr + offsetof(image::optional_header32, ImageBase), image_base, 4); }
+    put(file, opthdr + offsetof(image::optional_header32, SectionAlignment), 0x1000, 4);
+    put(file, opthdr + offsetof(image::optional_header32, FileAlignment), 0x200, 4);
+    put(file, opthdr + offsetof(image::optional_header32, SizeOfImage), 0x2000, 4);
+    put(file, opthdr + offsetof(image::optional_header32, SizeOfHeaders), 0x200, 4);
+    put(file, dirs - 4, image::numberof_directory_entries, 4);
+    put(file, dirs + size_t(image::directory_entry::export_) * 8, 0x1040, 4);
+    put(file, dirs + size_t(image::directory_entry::export_) * 8 + 4, 0x80, 4);
+    put(file, dirs + size_t(image::directory_entry::basereloc) * 8, 0x1180, 4);
+    put(file, dirs + size_t(image::directory_entry::basereloc) * 8 + 4, 12, 4);
+
+    const char name[8] = ".data";
+    for (size_t i = 0; i < 8; ++i) { file[sechdr + i] = u8(name[i]); }
+    put(file, sechdr + offsetof(image::section_header, Misc), 0x200, 4);
+    put(file, sechdr + offsetof(image::section_header, VirtualAddress), 0x1000, 4);
+    put(file, sechdr + offsetof(image::section_header, SizeOfRawData), 0x200, 4);
+    put(file, sechdr + offsetof(image::section_header, PointerToRawData), raw, 4);
+
+    // the pointer to relocate, pointing at the value of beta
+    put(file, at(0x1000), image_base + 0x1108, is64 ? 8 : 4);
+    // exports, names in order
+    put(file, at(0x1040) + offsetof(image::export_directory, Base), 1, 4);
+    put(file, at(0x1040) + offsetof(image::export_directory, NumberOfFunctions), 3, 4);
+    put(file, at(0x1040) + offsetof(image::export_directory, NumberOfNames), 3, 4);
+    put(file, at(0x1040) + offsetof(image::export_directory, AddressOfFunctions), 0x1070, 4);
+    put(file, at(0x1040) + offsetof(image::export_directory, AddressOfNames), 0x1080, 4);
+    put(file, at(0x1040) + offsetof(image::export_directory, AddressOfNameOrdinals), 0x1090, 4);
+    const char* names[3] = {"alpha", "beta", "gamma"};
+    for (u32 i = 0; i < 3; ++i) {
+        put(file, at(0x1070) + i * 4, 0x1100 + i * 8, 4);
+        put(file, at(0x1080) + i * 4, 0x10A0 + i * 8, 4);
+        put(file, at(0x1090) + i * 2, i, 2);
+        for (size_t c = 0; names[i][c]; ++c) { file[at(0x10A0 + i * 8) + c] = u8(names[i][c]); }
+    }
+    put(file, at(0x1108), 42, 4);
+    // one relocation block, one entry and padding
+    put(file, at(0x1180), 0x1000, 4);
+    put(file, at(0x1184), 12, 4);
+    put(file, at(0x1188), u16(is64 ? image::rel_based::dir64 : image::rel_based::highlow) << 12, 2);
+    return file;
+}
+
+static constexpr auto embedded = build_image();
+static constexpr auto info = ct::parse_image(embedded);
+static constexpr auto layout = ct::sections<ct::section_count(embedded)>(embedded);
+static constexpr auto exports = ct::exports<ct::export_count(embedded)>(embedded);
+static constexpr auto relocs = ct::relocations<ct::relocation_count(embedded)>(embedded);
+
+static_assert(info.valid && info.size_of_image == 0x2000, "headers");
+static_assert(layout.size() == 1 && layout[0].virtual_address == 0x1000, "sections");
+static_assert(exports.size() == 3 && exports.rva_of("beta") == 0x1108 && exports.find("delta") == nullptr, "exports");
+static_assert(relocs.size() == 1 && relocs[0].rva == 0x1000, "relocations");
+
+int main() {
+    std::vector<u8> mapped(info.size_of_image);
+    ct::copy_sections(mapped.data(), embedded, info, layout);
+    ct::apply_relocations(mapped.data(), relocs, u64(reinterpret_cast<size_t>(mapped.data()) - info.image_base));
+
+    auto value = ptr_at<u32>(mapped.data(), exports.rva_of("beta"));
+    auto pointer = ref_at<u32*>(mapped.data(), 0x1000);
+    printf("beta = %u, relocated pointer %s\n", *value, pointer == value ? "ok" : "WRONG");
+    return pointer == value && *value == 42 ? 0 : 1;
+}
+#else
+int main() {
+    puts("compile with C++20 to parse images at compile time");
+    return 0;
+}
+#endif
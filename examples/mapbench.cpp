@@ -0,0 +1,37 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include "petricks.hpp"
+
+// maps an image many times without running its entry point, works with the POSIX provider too
+
+using pe::runtime::loader::memory_module;
+
+std::vector<char> read_file(const char* name) {
+    std::vector<char> file_buf;
+    std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return file_buf; }
+    file_buf.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(file_buf.data(), file_buf.size());
+    return file_buf;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) { printf("usage: %s <dll> [rounds]\n", argv[0]); return 1; }
+    auto image = read_file(argv[1]);
+    if (image.empty()) { printf("cannot read %s\n", argv[1]); return 1; }
+    size_t rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        memory_module<> mod;
+        auto result = mod.map(image.data());
+        if (result != memory_module<>::errc::ok) { printf("map failed: %d\n", int(result)); return 1; }
+    }
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu maps, %.2f us per map+unmap\n", rounds, elapsed / rounds);
+    return 0;
+}
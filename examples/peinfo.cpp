@@ -50,6 +50,36 @@ std::string pad_hex(T val) {
     return lengthed_hex(sizeof(T) * 2, val);
 }
 
+std::string base_of_data(pe::image::optional_header32& opthdr) { return pad_hex(opthdr.BaseOfData); }
+std::string base_of_data(pe::image::optional_header64&) { return "N/A in x64"; }
+
+struct print_basics {
+    template <typename ImageT>
+    pe::image::data_directory* operator()(ImageT& image) {
+        auto& coffhdr = image.nthdr().FileHeader;
+        auto& opthdr = image.opthdr();
+        std::cout
+            << "================== 基 本 P E 头 信 息 ==================" << std::endl
+            << "入口点:         " << pad_hex(opthdr.AddressOfEntryPoint)    << std::endl
+            << "子系统:         " << pad_hex(opthdr.Subsystem)              << std::endl
+            << "镜像基址:       " << pad_hex(opthdr.ImageBase)              << std::endl
+            << "区段数目:       " << pad_hex(coffhdr.NumberOfSections)      << std::endl
+            << "镜像大小:       " << pad_hex(opthdr.SizeOfImage)            << std::endl
+            << "日期时间标志:   " << pad_hex(coffhdr.TimeDateStamp)         << std::endl
+            << "代码基址:       " << pad_hex(opthdr.BaseOfCode)             << std::endl
+            << "文件头大小:     " << pad_hex(opthdr.SizeOfHeaders)          << std::endl
+            << "数据基址:       " << base_of_data(opthdr)                   << std::endl
+            << "特征值:         " << pad_hex(coffhdr.Characteristics)       << std::endl
+            << "块对齐:         " << pad_hex(opthdr.SectionAlignment)       << std::endl
+            << "校验和:         " << pad_hex(opthdr.CheckSum)               << std::endl
+            << "文件块对齐:     " << pad_hex(opthdr.FileAlignment)          << std::endl
+            << "可选头部大小:   " << pad_hex(coffhdr.SizeOfOptionalHeader)  << std::endl
+            << "标志字:         " << pad_hex(opthdr.Magic)                  << std::endl
+            << "RVA数及大小:    " << pad_hex(opthdr.NumberOfRvaAndSizes)    << std::endl;
+        return opthdr.DataDirectory;
+    }
+};
+
 int main(int argc, char *argv[]) {
     SetConsoleOutputCP(65001);
 
@@ -85,55 +115,12 @@ int main(int argc, char *argv[]) {
 
     std::cout << std::left;
 
-    auto& coffhdr = nthdr.FileHeader;
-    pe::image::data_directory* datadirs;
-
-    if (nthdr.machine() == pe::image::file_machine::i386) {
-        auto& opthdr = nthdr.OptionalHeader.x32;
-        std::cout
-            << "================== 基 本 P E 头 信 息 ==================" << std::endl
-            << "入口点:         " << pad_hex(opthdr.AddressOfEntryPoint)    << std::endl
-            << "子系统:         " << pad_hex(opthdr.Subsystem)              << std::endl
-            << "镜像基址:       " << pad_hex(opthdr.ImageBase)              << std::endl
-            << "区段数目:       " << pad_hex(coffhdr.NumberOfSections)      << std::endl
-            << "镜像大小:       " << pad_hex(opthdr.SizeOfImage)            << std::endl
-            << "日期时间标志:   " << pad_hex(coffhdr.TimeDateStamp)         << std::endl
-            << "代码基址:       " << pad_hex(opthdr.BaseOfCode)             << std::endl
-            << "文件头大小:     " << pad_hex(opthdr.SizeOfHeaders)          << std::endl
-            << "数据基址:       " << pad_hex(opthdr.BaseOfData)             << std::endl
-            << "特征值:         " << pad_hex(coffhdr.Characteristics)       << std::endl
-            << "块对齐:         " << pad_hex(opthdr.SectionAlignment)       << std::endl
-            << "校验和:         " << pad_hex(opthdr.CheckSum)               << std::endl
-            << "文件块对齐:     " << pad_hex(opthdr.FileAlignment)          << std::endl
-            << "可选头部大小:   " << pad_hex(coffhdr.SizeOfOptionalHeader)  << std::endl
-            << "标志字:         " << pad_hex(opthdr.Magic)                  << std::endl
-            << "RVA数及大小:    " << pad_hex(opthdr.NumberOfRvaAndSizes)    << std::endl;
-        datadirs = opthdr.DataDirectory;
-    } else if (nthdr.machine() == pe::image::file_machine::amd64) {
-        auto& opthdr = nthdr.OptionalHeader.x64;
-        std::cout
-            << "================== 基 本 P E 头 信 息 ==================" << std::endl
-            << "入口点:         " << pad_hex(opthdr.AddressOfEntryPoint)    << std::endl
-            << "子系统:         " << pad_hex(opthdr.Subsystem)              << std::endl
-            << "镜像基址:       " << pad_hex(opthdr.ImageBase)              << std::endl
-            << "区段数目:       " << pad_hex(coffhdr.NumberOfSections)      << std::endl
-            << "镜像大小:       " << pad_hex(opthdr.SizeOfImage)            << std::endl
-            << "日期时间标志:   " << pad_hex(coffhdr.TimeDateStamp)         << std::endl
-            << "代码基址:       " << pad_hex(opthdr.BaseOfCode)             << std::endl
-            << "文件头大小:     " << pad_hex(opthdr.SizeOfHeaders)          << std::endl
-            << "数据基址:       " << "N/A in x64"                           << std::endl
-            << "特征值:         " << pad_hex(coffhdr.Characteristics)       << std::endl
-            << "块对齐:         " << pad_hex(opthdr.SectionAlignment)       << std::endl
-            << "校验和:         " << pad_hex(opthdr.CheckSum)               << std::endl
-            << "文件块对齐:     " << pad_hex(opthdr.FileAlignment)          << std::endl
-            << "可选头部大小:   " << pad_hex(coffhdr.SizeOfOptionalHeader)  << std::endl
-            << "标志字:         " << pad_hex(opthdr.Magic)                  << std::endl
-            << "RVA数及大小:    " << pad_hex(opthdr.NumberOfRvaAndSizes)    << std::endl;
-        datadirs = opthdr.DataDirectory;
-    } else {
+    auto magic = nthdr.OptionalHeader.x32.Magic;
+    if (magic != pe::image::nt_optional_hdr32_magic && magic != pe::image::nt_optional_hdr64_magic) {
         std::cout << "暂不支持此架构的PE文件" << std::endl;
         return 0;
     }
+    pe::image::data_directory* datadirs = pe::image::visit_image(file_buf.data(), print_basics{});
 
     std::cout
         << "======================= 目 录 表 =======================" << std::endl
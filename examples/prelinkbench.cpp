@@ -0,0 +1,42 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include "petricks.hpp"
+
+// opens a dll through a prelink_cache over and over, run it twice to see hits from a previous process
+
+using pe::runtime::loader::memory_module;
+using pe::runtime::loader::prelink_cache;
+
+std::vector<char> read_file(const char* name) {
+    std::vector<char> file_buf;
+    std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return file_buf; }
+    file_buf.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(file_buf.data(), file_buf.size());
+    return file_buf;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) { printf("usage: %s <dll> <cache directory> [rounds]\n", argv[0]); return 1; }
+    auto image = read_file(argv[1]);
+    if (image.empty()) { printf("cannot read %s\n", argv[1]); return 1; }
+    size_t rounds = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100;
+
+    prelink_cache<> cache(argv[2]);
+    // the image is hashed once, as a caller with a known identity would
+    auto key = cache.key_of(image.data(), image.size());
+    for (size_t i = 0; i < rounds; ++i) {
+        memory_module<> mod;
+        auto result = cache.open(mod, key, image.data());
+        if (result != memory_module<>::errc::ok) { printf("open failed: %d\n", int(result)); return 1; }
+    }
+
+    auto& stats = cache.stats();
+    printf("%zu hits, %zu misses, %zu stores, %zu rebinds\n", stats.hits, stats.misses, stats.stores, stats.rebinds);
+    if (stats.hits) { printf("hit:  %8.2f us per open, %.2f us of it validating\n", stats.hit_seconds / stats.hits * 1e6, stats.validate_seconds / stats.hits * 1e6); }
+    if (stats.misses) { printf("miss: %8.2f us per open\n", stats.miss_seconds / stats.misses * 1e6); }
+    return 0;
+}
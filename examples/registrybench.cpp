@@ -0,0 +1,49 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "petricks.hpp"
+
+// opens the same few modules from 1 to 64 threads through one module_registry
+
+using pe::runtime::loader::module_registry;
+
+std::vector<char> read_file(const char* name) {
+    std::vector<char> file_buf;
+    std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return file_buf; }
+    file_buf.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(file_buf.data(), file_buf.size());
+    return file_buf;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) { printf("usage: %s <dll> [rounds per thread] [keys]\n", argv[0]); return 1; }
+    auto image = read_file(argv[1]);
+    if (image.empty()) { printf("cannot read %s\n", argv[1]); return 1; }
+    size_t rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200000;
+    size_t keys = argc > 3 ? strtoul(argv[3], nullptr, 10) : 16;
+    // the same image under several keys, as if they were different modules
+    pe::u64 base_key = module_registry<>::key_of(image.data(), image.size());
+
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        module_registry<> registry;
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (size_t i = 0; i < rounds; ++i) {
+                    auto mod = registry.open(base_key + (i + t) % keys, image.data());
+                    if (!mod.first) { printf("open failed: %d\n", int(mod.second)); exit(1); }
+                }
+            });
+        }
+        for (auto& worker : workers) { worker.join(); }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%2zu threads: %6.1f M opens/s, %zu modules\n", threads, threads * rounds / elapsed / 1e6, registry.size());
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "petricks.hpp"
+
+// maps a synthetic image of a given size away from its preferred base,
+// copying then relocating in two passes against alloc_policy::fused_relocation
+
+using namespace pe;
+using namespace pe::runtime;
+using pe::runtime::loader::memory_module;
+namespace alloc_policy = pe::runtime::loader::alloc_policy;
+
+// never grants the preferred base, so that every map has to relocate
+struct moved_api : winapi_default {
+    static void* VirtualAlloc(void* lpAddress, size_t dwSize, u32 flAllocationType, u32 flProtect) {
+        if (lpAddress && (flAllocationType & mem::reserve)) { return nullptr; }
+        return winapi_default::VirtualAlloc(lpAddress, dwSize, flAllocationType, flProtect);
+    }
+};
+
+// headers, one data section of size bytes relocated every 64 bytes plus a field straddling each page end, .reloc
+std::vector<u8> synthetic_image(size_t size) {
+    const u32 page_size = 0x1000, per_page = page_size / 64 + 1;
+    const u32 block_size = u32(sizeof(image::base_relocation) + (per_page + 1) / 2 * 2 * sizeof(u16));
+    size = (size + page_size - 1) & ~size_t(page_size - 1);
+    u32 pages = u32(size / page_size);
+    // room for the zero block that ends the table
+    u32 reloc_size = (pages * block_size + u32(sizeof(image::base_relocation)) + page_size - 1) & ~(page_size - 1);
+    std::vector<u8> file(page_size + size + reloc_size);
+
+    auto& doshdr = ref_at<image::dos_header>(file.data());
+    doshdr.e_magic = image::dos_signature;
+    doshdr.e_lfanew = 0x80;
+    auto& nthdr = doshdr.nthdr();
+    nthdr.Signature = image::nt_signature;
+    nthdr.FileHeader.Machine = u16(image::file_machine::local);
+    nthdr.FileHeader.NumberOfSections = 2;
+    nthdr.FileHeader.SizeOfOptionalHeader = sizeof(image::optional_header);
+    auto& opthdr = nthdr.OptionalHeader.local;
+    opthdr.Magic = sizeof(void*) == 8 ? image::nt_optional_hdr64_magic : image::nt_optional_hdr32_magic;
+    opthdr.ImageBase = sizeof(void*) == 8 ? size_t(0x180000000ull) : size_t(0x10000000);
+    opthdr.SectionAlignment = opthdr.FileAlignment = page_size;
+    opthdr.SizeOfHeaders = page_size;
+    opthdr.SizeOfImage = u32(file.size());
+    opthdr.NumberOfRvaAndSizes = image::numberof_directory_entries;
+    opthdr.datadir(image::directory_entry::basereloc) = {u32(page_size + size), pages * block_size};
+
+    auto sechdr = nthdr.sechdrs().begin();
+    memcpy(sechdr[0].Name, ".data", 6);
+    sechdr[0].Misc.VirtualSize = sechdr[0].SizeOfRawData = u32(size);
+    sechdr[0].VirtualAddress = sechdr[0].PointerToRawData = page_size;
+    sechdr[0].Characteristics = image::scn::cnt_initialized_data | image::scn::mem_read | image::scn::mem_write;
+    memcpy(sechdr[1].Name, ".reloc", 7);
+    sechdr[1].Misc.VirtualSize = sechdr[1].SizeOfRawData = reloc_size;
+    sechdr[1].VirtualAddress = sechdr[1].PointerToRawData = u32(page_size + size);
+    sechdr[1].Characteristics = image::scn::cnt_initialized_data | image::scn::mem_read;
+
+    u32 seed = 1;
+    for (size_t i = page_size; i < page_size + size; ++i) { seed = seed * 1103515245 + 12345; file[i] = u8(seed >> 16); }
+    auto field = sizeof(void*) == 8 ? image::rel_based::dir64 : image::rel_based::highlow;
+    for (u32 page = 0; page < pages; ++page) {
+        auto& block = ref_at<image::base_relocation>(file.data(), page_size + size + page * block_size);
+        block.VirtualAddress = page_size + page * page_size;
+        block.SizeOfBlock = block_size;
+        auto entries = block.entries();
+        for (u32 i = 0; i < entries.size(); ++i) {
+            u16 offset = i + 1 < per_page ? u16(i * 64) : u16(page_size - 4);
+            entries[i].value = i < per_page && (i + 1 < per_page || page + 1 < pages) ? u16((u16(field) << 12) | offset) : 0;
+        }
+    }
+    return file;
+}
+
+double map_seconds(memory_module<moved_api>& mod, std::vector<u8>& image) {
+    auto start = std::chrono::steady_clock::now();
+    if (mod.map_sections(image.data()) != memory_module<moved_api>::errc::ok) { printf("map failed\n"); exit(1); }
+    mod.relocate();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 256;
+    size_t rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 5;
+    auto image = synthetic_image(megabytes << 20);
+    size_t data_size = ref_at<image::dos_header>(image.data()).nthdr().OptionalHeader.local.SizeOfImage;
+
+    // both modes must agree byte for byte
+    {
+        memory_module<moved_api> two_pass, fused({}, alloc_policy::fused_relocation);
+        map_seconds(two_pass, image);
+        map_seconds(fused, image);
+        // moved to where the two-pass one lives, the fused image must be the same bytes
+        image::rebase_image(fused.base_addr(), ref_at<image::dos_header>(fused.base_addr()).nthdr().OptionalHeader.local,
+            reinterpret_cast<size_t>(two_pass.base_addr()));
+        if (memcmp(two_pass.base_addr(), fused.base_addr(), data_size) != 0) { printf("fused and two-pass results differ\n"); return 1; }
+    }
+
+    for (int fused = 0; fused < 2; ++fused) {
+        double best = 1e9, total = 0;
+        for (size_t i = 0; i < rounds; ++i) {
+            memory_module<moved_api> mod({}, fused ? alloc_policy::fused_relocation : alloc_policy::normal);
+            double seconds = map_seconds(mod, image);
+            best = std::min(best, seconds);
+            total += seconds;
+        }
+        printf("%-9s %zu MB: best %7.2f ms (%5.2f GB/s), mean %7.2f ms\n", fused ? "fused" : "two-pass",
+            megabytes, best * 1e3, data_size / best / 1e9, total / rounds * 1e3);
+    }
+    return 0;
+}
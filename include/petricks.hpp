@@ -1,2 +1,18 @@
 #include "./petricks/rt-reflect.hpp"
 #include "./petricks/rt-loader.hpp"
+#include "./petricks/rt-symindex.hpp"
+#include "./petricks/rt-registry.hpp"
+#include "./petricks/rt-group.hpp"
+#include "./petricks/rt-batch.hpp"
+#include "./petricks/pdata.hpp"
+#include "./petricks/checksum.hpp"
+#include "./petricks/fingerprint.hpp"
+#include "./petricks/unmap.hpp"
+#include "./petricks/copy.hpp"
+#include "./petricks/rt-cache.hpp"
+#include "./petricks/ct-image.hpp"
+#include "./petricks/stats.hpp"
+#include "./petricks/coff.hpp"
+#include "./petricks/cfg.hpp"
+#include "./petricks/triage.hpp"
+#include "./petricks/apiset.hpp"
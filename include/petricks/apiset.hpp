@@ -0,0 +1,346 @@
+#pragma once
+#ifndef __PETRICKS_APISET__
+#define __PETRICKS_APISET__
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "./basics.hpp"
+
+/**
+ *  API set contracts (api-ms-win-*, ext-ms-*) are not files but names that the loader maps to a host dll,
+ *  through a schema the system maps into every process (PEB::ApiSetMap).
+ *  api_set_map parses a schema of version 2 (Windows 7), 4 (8.1) or 6 (10 and later) once into a flat table
+ *  sorted by contract, so a lookup is a binary search without touching the schema again.
+ *  Parsing only reads the blob given and checks every offset against its size, so a schema captured from
+ *  a Windows machine can be resolved anywhere.
+ */
+
+namespace pe {
+namespace runtime {
+namespace reflect {
+
+// Names are UTF-16 and offsets are from the start of the schema, lengths are in bytes.
+
+struct api_set_namespace_v2 {
+    u32 Version;
+    u32 Count; // api_set_namespace_entry_v2 records following
+}; // struct api_set_namespace_v2
+
+struct api_set_namespace_entry_v2 {
+    u32 NameOffset; // without the "api-" prefix and the extension
+    u32 NameLength;
+    u32 DataOffset; // api_set_value_array_v2
+}; // struct api_set_namespace_entry_v2
+
+struct api_set_value_array_v2 {
+    u32 Count; // api_set_value_entry_v2 records following
+}; // struct api_set_value_array_v2
+
+struct api_set_value_entry_v2 {
+    u32 NameOffset; // the importing module this host is for, empty for the default host
+    u32 NameLength;
+    u32 ValueOffset; // the host
+    u32 ValueLength;
+}; // struct api_set_value_entry_v2
+
+struct api_set_namespace_v4 {
+    u32 Version;
+    u32 Size;
+    u32 Flags;
+    u32 Count; // api_set_namespace_entry_v4 records following
+}; // struct api_set_namespace_v4
+
+struct api_set_namespace_entry_v4 {
+    u32 Flags;
+    u32 NameOffset; // without the "api-" or "ext-" prefix and the extension
+    u32 NameLength;
+    u32 AliasOffset;
+    u32 AliasLength;
+    u32 DataOffset; // api_set_value_array_v4
+}; // struct api_set_namespace_entry_v4
+
+struct api_set_value_array_v4 {
+    u32 Flags;
+    u32 Count; // api_set_value_entry_v4 records following
+}; // struct api_set_value_array_v4
+
+struct api_set_value_entry_v4 {
+    u32 Flags;
+    u32 NameOffset;
+    u32 NameLength;
+    u32 ValueOffset;
+    u32 ValueLength;
+}; // struct api_set_value_entry_v4
+
+struct api_set_namespace_v6 {
+    u32 Version;
+    u32 Size;
+    u32 Flags;
+    u32 Count;
+    u32 EntryOffset; // api_set_namespace_entry_v6[Count], sorted by name
+    u32 HashOffset; // api_set_hash_entry_v6[Count]
+    u32 HashFactor;
+}; // struct api_set_namespace_v6
+
+struct api_set_namespace_entry_v6 {
+    u32 Flags;
+    u32 NameOffset; // full name with its prefix, without the extension
+    u32 NameLength;
+    u32 HashedLength; // the name up to its last hyphen, which is what lookups compare
+    u32 ValueOffset; // api_set_value_entry_v6[ValueCount]
+    u32 ValueCount;
+}; // struct api_set_namespace_entry_v6
+
+using api_set_value_entry_v6 = api_set_value_entry_v4;
+
+struct api_set_hash_entry_v6 {
+    u32 Hash;
+    u32 Index;
+}; // struct api_set_hash_entry_v6
+
+class api_set_map {
+    struct _entry {
+        u32 contract; // offsets into _names
+        u32 contract_size;
+        u32 host;
+        u32 host_size;
+        u32 first_alias; // index into _aliases
+        u32 alias_count;
+    }; // struct _entry
+
+    struct _alias {
+        u32 importer;
+        u32 importer_size;
+        u32 host;
+        u32 host_size;
+    }; // struct _alias
+
+    // every name in lower case, each terminated so that hosts can be passed on as C strings
+    std::string _names;
+    std::vector<_entry> _entries; // sorted by contract
+    std::vector<_alias> _aliases;
+    u32 _version = 0;
+
+    const u8* _schema = nullptr;
+    size_t _schema_size = 0;
+
+    template <typename T>
+    const T* _at(u64 offset, u64 count = 1) const {
+        if (offset > _schema_size || count > (_schema_size - offset) / sizeof(T)) { return nullptr; }
+        return reinterpret_cast<const T*>(_schema + offset);
+    }
+
+    static char _lower(u32 ch) {
+        if (ch >= 'A' && ch <= 'Z') { return char(ch + ('a' - 'A')); }
+        return ch < 0x80 ? char(ch) : '?'; // names are ASCII in practice
+    }
+
+    static bool _has_prefix(string_view name) {
+        if (name.size() < 4) { return false; }
+        char prefix[4];
+        for (size_t i = 0; i < 4; ++i) { prefix[i] = _lower(u8(name[i])); }
+        return memcmp(prefix, "api-", 4) == 0 || memcmp(prefix, "ext-", 4) == 0;
+    }
+
+    // appends the UTF-16 name, lower cased and terminated, false if it is not inside the schema
+    bool _add_name(u32 offset, u32 length, u32& pos, u32& size) {
+        auto chars = _at<u16>(offset, length / 2);
+        if (!chars) { return false; }
+        pos = u32(_names.size());
+        size = length / 2;
+        for (u32 i = 0; i < size; ++i) {
+            u16 ch;
+            memcpy(&ch, chars + i, sizeof(ch));
+            _names.push_back(_lower(ch));
+        }
+        _names.push_back(0);
+        return true;
+    }
+
+    // adds value as the default host, or as an alias if it names an importing module
+    bool _add_value(_entry& entry, u32 name_offset, u32 name_length, u32 value_offset, u32 value_length) {
+        _alias alias;
+        if (!_add_name(value_offset, value_length, alias.host, alias.host_size)) { return false; }
+        if (name_length == 0) {
+            // the first default wins, as for the system loader
+            if (!entry.host_size) { entry.host = alias.host; entry.host_size = alias.host_size; }
+            return true;
+        }
+        if (!_add_name(name_offset, name_length, alias.importer, alias.importer_size)) { return false; }
+        _aliases.push_back(alias);
+        ++entry.alias_count;
+        return true;
+    }
+
+    // v2 and v4 compare names without their prefix, which older schemas do not store
+    void _strip_prefix(_entry& entry) {
+        if (!_has_prefix(string_view(&_names[entry.contract], entry.contract_size))) { return; }
+        entry.contract += 4;
+        entry.contract_size -= 4;
+    }
+
+    bool _parse_v2() {
+        auto header = _at<api_set_namespace_v2>(0);
+        if (!header) { return false; }
+        auto entries = _at<api_set_namespace_entry_v2>(sizeof(api_set_namespace_v2), header->Count);
+        if (!entries) { return false; }
+        for (u32 i = 0; i < header->Count; ++i) {
+            _entry entry = {0, 0, 0, 0, u32(_aliases.size()), 0};
+            if (!_add_name(entries[i].NameOffset, entries[i].NameLength, entry.contract, entry.contract_size)) { return false; }
+            _strip_prefix(entry);
+            auto values = _at<api_set_value_array_v2>(entries[i].DataOffset);
+            if (!values) { return false; }
+            auto value = _at<api_set_value_entry_v2>(u64(entries[i].DataOffset) + sizeof(api_set_value_array_v2), values->Count);
+            if (!value) { return false; }
+            for (u32 j = 0; j < values->Count; ++j) {
+                if (!_add_value(entry, value[j].NameOffset, value[j].NameLength, value[j].ValueOffset, value[j].ValueLength)) { return false; }
+            }
+            _entries.push_back(entry);
+        }
+        return true;
+    }
+
+    bool _parse_v4() {
+        auto header = _at<api_set_namespace_v4>(0);
+        if (!header) { return false; }
+        auto entries = _at<api_set_namespace_entry_v4>(sizeof(api_set_namespace_v4), header->Count);
+        if (!entries) { return false; }
+        for (u32 i = 0; i < header->Count; ++i) {
+            _entry entry = {0, 0, 0, 0, u32(_aliases.size()), 0};
+            if (!_add_name(entries[i].NameOffset, entries[i].NameLength, entry.contract, entry.contract_size)) { return false; }
+            _strip_prefix(entry);
+            auto values = _at<api_set_value_array_v4>(entries[i].DataOffset);
+            if (!values) { return false; }
+            auto value = _at<api_set_value_entry_v4>(u64(entries[i].DataOffset) + sizeof(api_set_value_array_v4), values->Count);
+            if (!value) { return false; }
+            for (u32 j = 0; j < values->Count; ++j) {
+                if (!_add_value(entry, value[j].NameOffset, value[j].NameLength, value[j].ValueOffset, value[j].ValueLength)) { return false; }
+            }
+            _entries.push_back(entry);
+        }
+        return true;
+    }
+
+    bool _parse_v6() {
+        auto header = _at<api_set_namespace_v6>(0);
+        if (!header) { return false; }
+        auto entries = _at<api_set_namespace_entry_v6>(header->EntryOffset, header->Count);
+        if (!entries) { return false; }
+        for (u32 i = 0; i < header->Count; ++i) {
+            _entry entry = {0, 0, 0, 0, u32(_aliases.size()), 0};
+            if (!_add_name(entries[i].NameOffset, entries[i].NameLength, entry.contract, entry.contract_size)) { return false; }
+            entry.contract_size = std::min(entry.contract_size, entries[i].HashedLength / 2);
+            auto value = _at<api_set_value_entry_v6>(entries[i].ValueOffset, entries[i].ValueCount);
+            if (!value) { return false; }
+            for (u32 j = 0; j < entries[i].ValueCount; ++j) {
+                if (!_add_value(entry, value[j].NameOffset, value[j].NameLength, value[j].ValueOffset, value[j].ValueLength)) { return false; }
+            }
+            _entries.push_back(entry);
+        }
+        return true;
+    }
+
+    static string_view _without_extension(string_view name) {
+        string_view suffix(".dll");
+        if (name.size() >= suffix.size() && windows_style_cmp<char, char>(name.substr(name.size() - suffix.size()), suffix)) {
+            name = name.substr(0, name.size() - suffix.size());
+        }
+        return name;
+    }
+
+    string_view _view(u32 pos, u32 size) const { return {_names.data() + pos, size}; }
+
+    // the contract part of a dll name as the entries of this version store it, empty if it is not a contract
+    size_t _key(string_view name, char* key, size_t key_size) const {
+        if (!_has_prefix(name)) { return 0; }
+        name = _without_extension(name);
+        if (_version >= 6) {
+            // the minor version after the last hyphen does not take part
+            size_t last = name.size();
+            while (last && name[last - 1] != '-') { --last; }
+            if (last) { name = name.substr(0, last - 1); }
+        } else {
+            name = name.substr(4);
+        }
+        if (name.size() > key_size) { return 0; }
+        for (size_t i = 0; i < name.size(); ++i) { key[i] = _lower(u8(name[i])); }
+        return name.size();
+    }
+
+public:
+    api_set_map() {}
+    api_set_map(const void* schema, size_t size) { parse(schema, size); }
+
+    /**
+     *  Replaces the map with the contents of schema, size bytes of it are readable.
+     *  On a damaged or unknown schema the map ends up empty and false is returned.
+     */
+    bool parse(const void* schema, size_t size) {
+        _names.clear(); _entries.clear(); _aliases.clear();
+        _schema = static_cast<const u8*>(schema);
+        _schema_size = size;
+        auto version = _at<u32>(0);
+        _version = version ? *version : 0;
+        bool parsed = false;
+        switch (_version) {
+            case 2: parsed = _parse_v2(); break;
+            case 4: parsed = _parse_v4(); break;
+            case 6: parsed = _parse_v6(); break;
+            default: break;
+        }
+        _schema = nullptr;
+        _schema_size = 0;
+        if (!parsed) { _names.clear(); _entries.clear(); _aliases.clear(); _version = 0; return false; }
+        std::sort(_entries.begin(), _entries.end(), [&](const _entry& a, const _entry& b) {
+            return std::lexicographical_compare(
+                _names.begin() + a.contract, _names.begin() + a.contract + a.contract_size,
+                _names.begin() + b.contract, _names.begin() + b.contract + b.contract_size);
+        });
+        return true;
+    }
+
+    u32 version() const { return _version; }
+    size_t size() const { return _entries.size(); }
+    explicit operator bool() const { return !_entries.empty(); }
+
+    // whether name looks like a contract, i.e. starts with "api-" or "ext-"
+    static bool is_contract(string_view name) { return _has_prefix(name); }
+
+    /**
+     *  The host dll of contract dll_name (with or without extension, any case), or empty if it is not a known
+     *  contract or has no host. importer, the name of the module asking, picks an alias host if the schema
+     *  has one for it. The host is in lower case and terminated, so data() may be passed on as a C string.
+     */
+    string_view resolve(string_view dll_name, string_view importer = string_view("", 0)) const {
+        char key[256];
+        size_t key_size = _key(dll_name, key, sizeof(key));
+        if (!key_size) { return {"", 0}; }
+        auto pos = std::lower_bound(_entries.begin(), _entries.end(), string_view(key, key_size),
+            [&](const _entry& entry, string_view wanted) {
+                return std::lexicographical_compare(
+                    _names.begin() + entry.contract, _names.begin() + entry.contract + entry.contract_size,
+                    wanted.begin(), wanted.end());
+            }
+        );
+        if (pos == _entries.end() || !(_view(pos->contract, pos->contract_size) == string_view(key, key_size))) { return {"", 0}; }
+        if (importer.size()) {
+            for (u32 i = 0; i < pos->alias_count; ++i) {
+                auto& alias = _aliases[pos->first_alias + i];
+                // importers compare like dll names: any case, extension optional
+                if (windows_style_cmp<char, char>(_without_extension(_view(alias.importer, alias.importer_size)), _without_extension(importer))) { return _view(alias.host, alias.host_size); }
+            }
+        }
+        return pos->host_size ? _view(pos->host, pos->host_size) : string_view("", 0);
+    }
+    string_view resolve(const char* dll_name, const char* importer = nullptr) const {
+        return resolve(string_view(dll_name), importer ? string_view(importer) : string_view("", 0));
+    }
+}; // class api_set_map
+
+} // namespace reflect
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_APISET__
@@ -3,7 +3,11 @@
 #define __PETRICKS_BASICS__
 
 #include <cstdint>
+#include <cstring>
+#include <vector>
+#include <utility>
 #include "./reimpl.hpp"
+#include "./stats.hpp"
 
 namespace pe {
 
@@ -53,12 +57,21 @@ public:
     iterator end() { return {nullptr}; }
 }; // class sentinel_span
 
+// iteration control for plain arrays ended by a zero element
+template <typename T>
+struct zero_terminated {
+    static T* increment(T* pos) { return pos + 1; }
+    static bool sentinel(T* pos) { return *pos == 0; }
+};
+
 namespace image {
 
 constexpr size_t numberof_directory_entries = 16;
 constexpr u32 dos_signature = 0x5A4D;
 constexpr u32 nt_signature = 0x00004550;
 constexpr size_t sizeof_short_name = 8;
+constexpr u16 nt_optional_hdr32_magic = 0x10b;
+constexpr u16 nt_optional_hdr64_magic = 0x20b;
 
 enum class directory_entry {
     export_ = 0,
@@ -112,9 +125,11 @@ enum class file_machine {
     amd64 = 0x8664,
     m32r = 0x9041,
     cee = 0xc0ee,
-#if defined(_WIN64)
+#if defined(_M_ARM64) || defined(__aarch64__)
+    local = arm64,
+#elif defined(_M_X64) || defined(__x86_64__)
     local = amd64,
-#elif defined(_WIN32)
+#elif defined(_M_IX86) || defined(__i386__)
     local = i386,
 #endif
 }; // enum class file_machine
@@ -175,6 +190,36 @@ namespace scn {
     constexpr u32 scale_index = 0x00000001;
 } // namespace scn
 
+// load_config_directory32/64::GuardFlags and the metadata of GuardCFFunctionTable entries
+namespace guard {
+    constexpr u32 cf_instrumented = 0x00000100;
+    constexpr u32 cfw_instrumented = 0x00000200;
+    constexpr u32 cf_function_table_present = 0x00000400;
+    constexpr u32 security_cookie_unused = 0x00000800;
+    constexpr u32 protect_delayload_iat = 0x00001000;
+    constexpr u32 delayload_iat_in_its_own_section = 0x00002000;
+    constexpr u32 cf_export_suppression_info_present = 0x00004000;
+    constexpr u32 cf_enable_export_suppression = 0x00008000;
+    constexpr u32 cf_longjump_table_present = 0x00010000;
+    constexpr u32 rf_instrumented = 0x00020000;
+    constexpr u32 rf_enable = 0x00040000;
+    constexpr u32 rf_strict = 0x00080000;
+    constexpr u32 retpoline_present = 0x00100000;
+    constexpr u32 eh_continuation_table_present = 0x00400000;
+    constexpr u32 xfg_enabled = 0x00800000;
+    constexpr u32 castguard_present = 0x01000000;
+    constexpr u32 memcpy_present = 0x02000000;
+    // bytes of metadata after each RVA in the GuardCFFunctionTable
+    constexpr u32 cf_function_table_size_mask = 0xF0000000;
+    constexpr u32 cf_function_table_size_shift = 28;
+
+    // the metadata byte of a GuardCFFunctionTable entry
+    constexpr u8 fid_suppressed = 0x01;
+    constexpr u8 export_suppressed = 0x02;
+    constexpr u8 fid_langexcpthandler = 0x04;
+    constexpr u8 fid_xfg = 0x08;
+} // namespace guard
+
 struct nt_headers;
 
 #pragma pack(push,2)
@@ -295,9 +340,10 @@ struct optional_header64 {
     }
 }; // struct optional_header64
 
-#if defined(_WIN64)
+// aliases for the host, what runtime code works with
+#if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
 using optional_header = optional_header64;
-#elif defined(_WIN32)
+#else
 using optional_header = optional_header32;
 #endif
 
@@ -319,6 +365,8 @@ struct nt_headers {
     span<section_header> sechdrs() {
         return {&first_section(), FileHeader.NumberOfSections};
     }
+    // for images read straight from disk, size_t(-1) if rva is not backed by file data
+    size_t rva_to_offset(u32 rva);
 }; // struct nt_headers
 
 struct export_directory {
@@ -335,6 +383,129 @@ struct export_directory {
     u32 AddressOfNameOrdinals;
 }; // struct export_directory
 
+struct export_entry {
+    u32 ordinal; // already biased by export_directory::Base
+    const char* name; // nullptr if exported by ordinal only
+    u32 rva;
+    const char* forwarder; // "module.symbol" or "module.#ordinal" if forwarded, nullptr otherwise
+}; // struct export_entry
+
+/**
+ *  Reads the three parallel arrays of the export directory in place.
+ *  Iterating the view walks the name table once, yielding named exports in lexical order.
+ *  by_ordinal() walks the address table instead, and names it through a reverse map
+ *  that is built on first use only.
+ */
+class export_view {
+    void* _base;
+    data_directory _pos;
+    export_directory* _dir;
+    std::vector<u32> _name_of; // function index -> name index + 1, 0 if unnamed
+
+    export_entry _make(u32 func_idx, const char* name) {
+        u32 rva = functions()[func_idx];
+        return {_dir->Base + func_idx, name, rva, is_forwarder(rva) ? ptr_at<char>(_base, rva) : nullptr};
+    }
+
+public:
+    template <typename OpthdrT>
+    export_view(void* base, OpthdrT& opthdr) : _base(base), _pos(opthdr.datadir(directory_entry::export_)) {
+        _dir = _pos.Size ? ptr_at<export_directory>(base, _pos.VirtualAddress) : nullptr;
+    }
+    template <typename OpthdrT>
+    export_view(OpthdrT& opthdr) : export_view(reinterpret_cast<void*>(opthdr.ImageBase), opthdr) {}
+
+    explicit operator bool() const { return _dir != nullptr; }
+    export_directory& directory() { return *_dir; }
+    const char* module_name() { return ptr_at<char>(_base, _dir->Name); }
+
+    span<u32> functions() { return _dir ? span<u32>(ptr_at<u32>(_base, _dir->AddressOfFunctions), _dir->NumberOfFunctions) : span<u32>(); }
+    span<u32> names() { return _dir ? span<u32>(ptr_at<u32>(_base, _dir->AddressOfNames), _dir->NumberOfNames) : span<u32>(); }
+    span<u16> name_ordinals() { return _dir ? span<u16>(ptr_at<u16>(_base, _dir->AddressOfNameOrdinals), _dir->NumberOfNames) : span<u16>(); }
+    const char* name_at(size_t name_idx) { return ptr_at<char>(_base, names()[name_idx]); }
+
+    bool is_forwarder(u32 rva) const { return rva >= _pos.VirtualAddress && rva - _pos.VirtualAddress < _pos.Size; }
+
+    class iterator {
+        export_view* _view; size_t _idx;
+    public:
+        iterator(export_view* view, size_t idx) : _view(view), _idx(idx) {}
+        export_entry operator*() const { return _view->_make(_view->name_ordinals()[_idx], _view->name_at(_idx)); }
+        bool operator==(iterator other) const { return _idx == other._idx; }
+        bool operator!=(iterator other) const { return !(*this == other); }
+        iterator& operator++() { ++_idx; return *this; }
+    };
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, _dir ? _dir->NumberOfNames : 0}; }
+
+    // ordinal -> name, the map is built on the first call
+    const char* name_of(u32 ordinal) {
+        if (!_dir || ordinal - _dir->Base >= _dir->NumberOfFunctions) { return nullptr; }
+        if (_name_of.empty()) {
+            _name_of.assign(_dir->NumberOfFunctions, 0);
+            auto ordinals = name_ordinals();
+            for (size_t i = 0; i < ordinals.size(); ++i) {
+                if (ordinals[i] < _name_of.size()) { _name_of[ordinals[i]] = u32(i + 1); }
+            }
+        }
+        u32 name_idx = _name_of[ordinal - _dir->Base];
+        return name_idx ? name_at(name_idx - 1) : nullptr;
+    }
+
+    class ordinal_range {
+        export_view* _view;
+    public:
+        ordinal_range(export_view* view) : _view(view) {}
+        class iterator {
+            export_view* _view; size_t _idx;
+            void _skip_empty() { for (auto funcs = _view->functions(); _idx < funcs.size() && funcs[_idx] == 0; ++_idx) {} }
+        public:
+            iterator(export_view* view, size_t idx) : _view(view), _idx(idx) { _skip_empty(); }
+            export_entry operator*() const { return _view->_make(u32(_idx), _view->name_of(_view->_dir->Base + u32(_idx))); }
+            bool operator==(iterator other) const { return _idx == other._idx; }
+            bool operator!=(iterator other) const { return !(*this == other); }
+            iterator& operator++() { ++_idx; _skip_empty(); return *this; }
+        };
+        iterator begin() { return {_view, 0}; }
+        iterator end() { return {_view, _view->functions().size()}; }
+    }; // class ordinal_range
+    // every non-empty slot of the address table, including exports without a name
+    ordinal_range by_ordinal() { return {this}; }
+
+    // https://learn.microsoft.com/en-us/windows/win32/debug/pe-format#export-name-pointer-table
+    // Export name table is lexically ordered to allow binary searches. rva 0 if not found.
+    u32 rva_of(const char* name) {
+        if (!_dir) { return 0; }
+        auto export_names = names();
+        auto name_pos = std::lower_bound(export_names.begin(), export_names.end(), name,
+            [&](const u32& export_name_rva, const char* name) {
+                stats::add(stats::counter::search_probes);
+                return strcmp(ptr_at<char>(_base, export_name_rva), name) < 0;
+            }
+        );
+        stats::add(stats::counter::name_compares);
+        if (name_pos == export_names.end() || strcmp(ptr_at<char>(_base, *name_pos), name) != 0) { return 0; }
+        return functions()[name_ordinals()[name_pos - export_names.begin()]];
+    }
+    // rva_of(name) trying AddressOfNames[hint] first, as the system loader does with import_by_name::Hint
+    u32 rva_of(const char* name, u16 hint, bool& hint_hit) {
+        hint_hit = false;
+        if (!_dir) { return 0; }
+        if (hint < _dir->NumberOfNames) {
+            stats::add(stats::counter::name_compares);
+            if (strcmp(name_at(hint), name) == 0) {
+                hint_hit = true;
+                return functions()[name_ordinals()[hint]];
+            }
+        }
+        return rva_of(name);
+    }
+    u32 rva_of(u16 ordinal) {
+        if (!_dir || u32(ordinal) - _dir->Base >= _dir->NumberOfFunctions) { return 0; }
+        return functions()[ordinal - _dir->Base];
+    }
+}; // class export_view
+
 struct section_header {
     u8 Name[sizeof_short_name];
     union {
@@ -351,6 +522,17 @@ struct section_header {
     u32 Characteristics;
 }; // struct section_header
 
+inline size_t nt_headers::rva_to_offset(u32 rva) {
+    // SizeOfHeaders sits at the same offset in PE32 and PE32+
+    if (rva < OptionalHeader.x32.SizeOfHeaders) { return rva; }
+    for (auto& sechdr : sechdrs()) {
+        if (rva >= sechdr.VirtualAddress && rva - sechdr.VirtualAddress < sechdr.SizeOfRawData) {
+            return size_t(sechdr.PointerToRawData) + (rva - sechdr.VirtualAddress);
+        }
+    }
+    return size_t(-1);
+}
+
 struct base_relocation {
     u32 VirtualAddress;
     u32 SizeOfBlock;
@@ -386,6 +568,102 @@ static inline sentinel_view<base_relocation> basereloc_view(OpthdrT& opthdr) {
     return basereloc_view(reinterpret_cast<void*>(opthdr.ImageBase), opthdr);
 }
 
+template <typename T>
+static inline void add_unaligned(void* pos, T value) {
+    T orig;
+    memcpy(&orig, pos, sizeof(T));
+    orig += value;
+    memcpy(pos, &orig, sizeof(T));
+}
+
+/**
+ *  Applies one relocation block, i.e. one page, to the bytes at page.
+ *  page is usually base + block.VirtualAddress, but may point at a copy of that page anywhere.
+ */
+static inline void apply_relocation_block(base_relocation& block, void* page, u64 delta) {
+    bool is_highadj_param = false;
+    for (auto& reloc : block.entries()) {
+        // skip this if last is highadj
+        if (is_highadj_param) { is_highadj_param = false; continue; }
+        // Note: for most modules, only highlow and dir64 is used.
+        auto patch_pos = ptr_at<void>(page, reloc.offset());
+        switch (reloc.flag()) {
+            case rel_based::absolute: break;
+            case rel_based::high: {
+                add_unaligned<u16>(patch_pos, u16(u32(delta) >> 16));
+            } break;
+            case rel_based::low: {
+                add_unaligned<u16>(patch_pos, u16(u32(delta) & 0xFFFF));
+            } break;
+            case rel_based::highlow: {
+                add_unaligned<u32>(patch_pos, u32(delta));
+            } break;
+            case rel_based::highadj: {
+                // I just cannot understand what microsoft said on this in documentation.
+                // You may hope sane compilers never use this.
+                // The following is based on: https://github.com/BHTY/EmuWoW/blob/main/pe.c#L121-L127
+                u32 wtf = u32(delta) + u32(reloc.highadj_param()) + 0x8000;
+                add_unaligned<u16>(patch_pos, u16(wtf >> 16));
+                is_highadj_param = true;
+            } break;
+            case rel_based::dir64: {
+                add_unaligned<u64>(patch_pos, delta);
+            } break;
+            default: ; // skips unknown reloc
+        }
+    }
+}
+
+// adds delta to every relocated location of the mapped image at base
+template <typename OpthdrT>
+static inline void apply_relocations(void* base, OpthdrT& opthdr, u64 delta) {
+    if (delta == 0) { return; }
+    for (auto& block : basereloc_view(base, opthdr)) {
+        apply_relocation_block(block, ptr_at<void>(base, block.VirtualAddress), delta);
+    }
+}
+
+/**
+ *  Rebases the mapped image currently stored at image so that it is correct when it lives at new_base.
+ *  Only relocations are applied: sections are not copied and imports are left as they are.
+ *  Pointers into the image created at run time (e.g. by its entry point) are beyond reach.
+ */
+template <typename OpthdrT>
+static inline void rebase_image(void* image, OpthdrT& opthdr, u64 new_base) {
+    apply_relocations(image, opthdr, u64(new_base - opthdr.ImageBase));
+    opthdr.ImageBase = decltype(opthdr.ImageBase)(new_base);
+}
+
+// Layout used by amd64 and ia64, entries in .pdata are sorted by BeginAddress.
+struct runtime_function {
+    u32 BeginAddress;
+    u32 EndAddress;
+    u32 UnwindInfoAddress;
+
+    bool contains(u32 rva) const { return rva >= BeginAddress && rva < EndAddress; }
+}; // struct runtime_function
+
+template <typename OpthdrT>
+static inline span<runtime_function> exception_view(void* base, OpthdrT& opthdr) {
+    data_directory& pdata_pos = opthdr.datadir(directory_entry::exception);
+    if (!pdata_pos.Size) { return {nullptr, 0}; }
+    return {ptr_at<runtime_function>(base, pdata_pos.VirtualAddress), pdata_pos.Size / sizeof(runtime_function)};
+}
+template <typename OpthdrT>
+static inline span<runtime_function> exception_view(OpthdrT& opthdr) {
+    return exception_view(reinterpret_cast<void*>(opthdr.ImageBase), opthdr);
+}
+
+// binary search for the function containing rva, nullptr if rva is not covered (e.g. leaf functions)
+static inline runtime_function* find_runtime_function(span<runtime_function> table, u32 rva) {
+    auto pos = std::upper_bound(table.begin(), table.end(), rva,
+        [](u32 rva, const runtime_function& func) { return rva < func.BeginAddress; }
+    );
+    if (pos == table.begin()) { return nullptr; }
+    --pos;
+    return pos->contains(rva) ? pos : nullptr;
+}
+
 struct import_descriptor {
     u32 OriginalFirstThunk; // The name "Characteristics" is used in Winnt.h, but no longer describes this field.
     u32 TimeDateStamp;
@@ -415,6 +693,38 @@ static inline sentinel_view<import_descriptor> imports_view(OpthdrT& opthdr) {
     return imports_view(reinterpret_cast<void*>(opthdr.ImageBase), opthdr);
 }
 
+struct delayload_descriptor {
+    u32 Attributes;
+    u32 DllNameRVA;
+    u32 ModuleHandleRVA;
+    u32 ImportAddressTableRVA;
+    u32 ImportNameTableRVA;
+    u32 BoundImportAddressTableRVA;
+    u32 UnloadInformationTableRVA;
+    u32 TimeDateStamp;
+
+    // Only the VC6-era layout stores VAs instead of RVAs, loaders nowadays reject it.
+    bool rva_based() { return Attributes & 1; }
+    bool termination() { return DllNameRVA == 0; }
+
+    struct iter {
+        static delayload_descriptor* increment(delayload_descriptor* pos) { return pos + 1; }
+        static bool sentinel(delayload_descriptor* pos) { return pos->termination(); }
+    };
+}; // struct delayload_descriptor
+
+template <typename OpthdrT>
+static inline sentinel_view<delayload_descriptor> delay_imports_view(void* base, OpthdrT& opthdr) {
+    data_directory& delay_pos = opthdr.datadir(directory_entry::delay_import);
+    if (!delay_pos.Size) { return {nullptr}; }
+    auto first = ptr_at<image::delayload_descriptor>(base, delay_pos.VirtualAddress);
+    return {first->termination() ? nullptr : first};
+}
+template <typename OpthdrT>
+static inline sentinel_view<delayload_descriptor> delay_imports_view(OpthdrT& opthdr) {
+    return delay_imports_view(reinterpret_cast<void*>(opthdr.ImageBase), opthdr);
+}
+
 struct import_by_name {
     u16 Hint;
     char Name[1];
@@ -426,6 +736,11 @@ struct thunk_data32 {
     bool flag() { return value >> 31; }
     u16 ordinal() { return value & 0xFFFF; }
     u32 name_rva() { return value & 0x7FFFFFFF; }
+
+    struct iter {
+        static thunk_data32* increment(thunk_data32* pos) { return pos + 1; }
+        static bool sentinel(thunk_data32* pos) { return pos->termination(); }
+    };
 }; // struct thunk_data32
 
 struct thunk_data64 {
@@ -434,14 +749,266 @@ struct thunk_data64 {
     bool flag() { return value >> 63; }
     u16 ordinal() { return value & 0xFFFF; }
     u32 name_rva() { return value & 0x7FFFFFFF; } // Even in 64-bit, name RVA only uses 31 bits
+
+    struct iter {
+        static thunk_data64* increment(thunk_data64* pos) { return pos + 1; }
+        static bool sentinel(thunk_data64* pos) { return pos->termination(); }
+    };
 }; // struct thunk_data64
 
-#if defined(_WIN64)
+#if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
 using thunk_data = thunk_data64;
-#elif defined(_WIN32)
+#else
 using thunk_data = thunk_data32;
 #endif
 
+struct tls_directory32 {
+    u32 StartAddressOfRawData;
+    u32 EndAddressOfRawData;
+    u32 AddressOfIndex;
+    u32 AddressOfCallBacks;
+    u32 SizeOfZeroFill;
+    u32 Characteristics;
+}; // struct tls_directory32
+
+struct tls_directory64 {
+    u64 StartAddressOfRawData;
+    u64 EndAddressOfRawData;
+    u64 AddressOfIndex;
+    u64 AddressOfCallBacks;
+    u32 SizeOfZeroFill;
+    u32 Characteristics;
+}; // struct tls_directory64
+
+struct load_config_code_integrity {
+    u16 Flags;
+    u16 Catalog;
+    u32 CatalogOffset;
+    u32 Reserved;
+}; // struct load_config_code_integrity
+
+// The directory grew with every Windows release, Size tells how much of it an image has, see covers.
+struct load_config_directory32 {
+    u32 Size;
+    u32 TimeDateStamp;
+    u16 MajorVersion;
+    u16 MinorVersion;
+    u32 GlobalFlagsClear;
+    u32 GlobalFlagsSet;
+    u32 CriticalSectionDefaultTimeout;
+    u32 DeCommitFreeBlockThreshold;
+    u32 DeCommitTotalFreeThreshold;
+    u32 LockPrefixTable;
+    u32 MaximumAllocationSize;
+    u32 VirtualMemoryThreshold;
+    u32 ProcessHeapFlags;
+    u32 ProcessAffinityMask;
+    u16 CSDVersion;
+    u16 DependentLoadFlags;
+    u32 EditList;
+    u32 SecurityCookie;
+    u32 SEHandlerTable;
+    u32 SEHandlerCount;
+    u32 GuardCFCheckFunctionPointer;
+    u32 GuardCFDispatchFunctionPointer;
+    u32 GuardCFFunctionTable; // VA of RVAs sorted ascending, each followed by metadata, see guard::cf_function_table_size_mask
+    u32 GuardCFFunctionCount;
+    u32 GuardFlags;
+    load_config_code_integrity CodeIntegrity;
+    u32 GuardAddressTakenIatEntryTable;
+    u32 GuardAddressTakenIatEntryCount;
+    u32 GuardLongJumpTargetTable;
+    u32 GuardLongJumpTargetCount;
+    u32 DynamicValueRelocTable;
+    u32 CHPEMetadataPointer;
+    u32 GuardRFFailureRoutine;
+    u32 GuardRFFailureRoutineFunctionPointer;
+    u32 DynamicValueRelocTableOffset;
+    u16 DynamicValueRelocTableSection;
+    u16 Reserved2;
+    u32 GuardRFVerifyStackPointerFunctionPointer;
+    u32 HotPatchTableOffset;
+    u32 Reserved3;
+    u32 EnclaveConfigurationPointer;
+    u32 VolatileMetadataPointer;
+    u32 GuardEHContinuationTable;
+    u32 GuardEHContinuationCount;
+    u32 GuardXFGCheckFunctionPointer;
+    u32 GuardXFGDispatchFunctionPointer;
+    u32 GuardXFGTableDispatchFunctionPointer;
+    u32 CastGuardOsDeterminedFailureMode;
+    u32 GuardMemcpyFunctionPointer;
+
+    // whether field, a member of this directory, is within Size
+    template <typename T>
+    bool covers(const T& field) const {
+        return size_t(reinterpret_cast<const u8*>(&field) - reinterpret_cast<const u8*>(this)) + sizeof(T) <= Size;
+    }
+}; // struct load_config_directory32
+
+struct load_config_directory64 {
+    u32 Size;
+    u32 TimeDateStamp;
+    u16 MajorVersion;
+    u16 MinorVersion;
+    u32 GlobalFlagsClear;
+    u32 GlobalFlagsSet;
+    u32 CriticalSectionDefaultTimeout;
+    u64 DeCommitFreeBlockThreshold;
+    u64 DeCommitTotalFreeThreshold;
+    u64 LockPrefixTable;
+    u64 MaximumAllocationSize;
+    u64 VirtualMemoryThreshold;
+    u64 ProcessAffinityMask;
+    u32 ProcessHeapFlags;
+    u16 CSDVersion;
+    u16 DependentLoadFlags;
+    u64 EditList;
+    u64 SecurityCookie;
+    u64 SEHandlerTable;
+    u64 SEHandlerCount;
+    u64 GuardCFCheckFunctionPointer;
+    u64 GuardCFDispatchFunctionPointer;
+    u64 GuardCFFunctionTable; // VA of RVAs sorted ascending, each followed by metadata, see guard::cf_function_table_size_mask
+    u64 GuardCFFunctionCount;
+    u32 GuardFlags;
+    load_config_code_integrity CodeIntegrity;
+    u64 GuardAddressTakenIatEntryTable;
+    u64 GuardAddressTakenIatEntryCount;
+    u64 GuardLongJumpTargetTable;
+    u64 GuardLongJumpTargetCount;
+    u64 DynamicValueRelocTable;
+    u64 CHPEMetadataPointer;
+    u64 GuardRFFailureRoutine;
+    u64 GuardRFFailureRoutineFunctionPointer;
+    u32 DynamicValueRelocTableOffset;
+    u16 DynamicValueRelocTableSection;
+    u16 Reserved2;
+    u64 GuardRFVerifyStackPointerFunctionPointer;
+    u32 HotPatchTableOffset;
+    u32 Reserved3;
+    u64 EnclaveConfigurationPointer;
+    u64 VolatileMetadataPointer;
+    u64 GuardEHContinuationTable;
+    u64 GuardEHContinuationCount;
+    u64 GuardXFGCheckFunctionPointer;
+    u64 GuardXFGDispatchFunctionPointer;
+    u64 GuardXFGTableDispatchFunctionPointer;
+    u64 CastGuardOsDeterminedFailureMode;
+    u64 GuardMemcpyFunctionPointer;
+
+    template <typename T>
+    bool covers(const T& field) const {
+        return size_t(reinterpret_cast<const u8*>(&field) - reinterpret_cast<const u8*>(this)) + sizeof(T) <= Size;
+    }
+}; // struct load_config_directory64
+
+static_assert(sizeof(load_config_directory32) == 0xC0, "load_config_directory32 layout");
+static_assert(sizeof(load_config_directory64) == 0x140, "load_config_directory64 layout");
+
+template <typename OpthdrT> struct image_traits;
+
+template <> struct image_traits<optional_header32> {
+    using thunk_type = thunk_data32;
+    using tls_directory_type = tls_directory32;
+    using load_config_type = load_config_directory32;
+    using va_type = u32;
+    static constexpr u16 magic = nt_optional_hdr32_magic;
+}; // struct image_traits<optional_header32>
+
+template <> struct image_traits<optional_header64> {
+    using thunk_type = thunk_data64;
+    using tls_directory_type = tls_directory64;
+    using load_config_type = load_config_directory64;
+    using va_type = u64;
+    static constexpr u16 magic = nt_optional_hdr64_magic;
+}; // struct image_traits<optional_header64>
+
+/**
+ *  A mapped image of a fixed bitness, independent of the host.
+ *  Everything layout dependent is resolved by the template arguments, so loops over
+ *  imports, relocations and TLS callbacks carry no PE32/PE32+ checks.
+ *  Pick the specialization once per image with visit_image.
+ */
+template <typename OpthdrT, typename ThunkT = typename image_traits<OpthdrT>::thunk_type>
+class image_view {
+    void* _base;
+
+public:
+    using optional_header_type = OpthdrT;
+    using thunk_type = ThunkT;
+    using tls_directory_type = typename image_traits<OpthdrT>::tls_directory_type;
+    using load_config_type = typename image_traits<OpthdrT>::load_config_type;
+    using va_type = typename image_traits<OpthdrT>::va_type;
+
+    image_view(void* base) : _base(base) {}
+
+    void* base() const { return _base; }
+    nt_headers& nthdr() { return ref_at<dos_header>(_base).nthdr(); }
+    OpthdrT& opthdr() { return reinterpret_cast<OpthdrT&>(nthdr().OptionalHeader); }
+    span<section_header> sechdrs() { return nthdr().sechdrs(); }
+    data_directory& datadir(directory_entry type) { return opthdr().datadir(type); }
+    template <typename T>
+    T* at(u32 rva) { return ptr_at<T>(_base, rva); }
+
+    sentinel_view<import_descriptor> imports() { return imports_view(_base, opthdr()); }
+    sentinel_view<delayload_descriptor> delay_imports() { return delay_imports_view(_base, opthdr()); }
+    sentinel_view<base_relocation> relocations() { return basereloc_view(_base, opthdr()); }
+    span<runtime_function> exception_table() { return exception_view(_base, opthdr()); }
+    export_view exports() { return {_base, opthdr()}; }
+
+    // a lookup (or address) table of thunks, e.g. import_descriptor::OriginalFirstThunk
+    sentinel_view<ThunkT> thunks(u32 rva) {
+        auto first = at<ThunkT>(rva);
+        return {rva == 0 || first->termination() ? nullptr : first};
+    }
+
+    tls_directory_type* tls() {
+        data_directory& tls_pos = datadir(directory_entry::tls);
+        return tls_pos.Size ? at<tls_directory_type>(tls_pos.VirtualAddress) : nullptr;
+    }
+    // callbacks are VAs, so this is only meaningful after relocation (or at the preferred base)
+    sentinel_view<va_type, zero_terminated<va_type>> tls_callbacks() {
+        auto dir = tls();
+        if (!dir || !dir->AddressOfCallBacks) { return {nullptr}; }
+        auto first = at<va_type>(u32(dir->AddressOfCallBacks - opthdr().ImageBase));
+        return {*first ? first : nullptr};
+    }
+
+    // nullptr without a load config directory, check covers before reading fields of newer layouts
+    load_config_type* load_config() {
+        data_directory& config_pos = datadir(directory_entry::load_config);
+        if (!config_pos.Size) { return nullptr; }
+        auto dir = at<load_config_type>(config_pos.VirtualAddress);
+        return dir->Size ? dir : nullptr;
+    }
+}; // class image_view
+
+using image_view32 = image_view<optional_header32>;
+using image_view64 = image_view<optional_header64>;
+
+/**
+ *  Checks the optional header magic once and calls func with the matching image_view.
+ *  func needs a call operator for both image_view32 and image_view64.
+ */
+template <typename FuncT>
+static inline auto visit_image(void* base, FuncT&& func) -> decltype(func(std::declval<image_view32&>())) {
+    auto& opthdr = ref_at<dos_header>(base).nthdr().OptionalHeader;
+    if (opthdr.x32.Magic == nt_optional_hdr64_magic) {
+        image_view64 view(base);
+        return func(view);
+    }
+    image_view32 view(base);
+    return func(view);
+}
+
+// rebase_image for an image of either bitness
+static inline void rebase_image(void* image, u64 new_base) {
+    auto& opthdr = ref_at<dos_header>(image).nthdr().OptionalHeader;
+    if (opthdr.x32.Magic == nt_optional_hdr64_magic) { rebase_image(image, opthdr.x64, new_base); }
+    else { rebase_image(image, opthdr.x32, new_base); }
+}
+
 } // namespace image
 
 } // namespace pe
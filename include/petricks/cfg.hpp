@@ -0,0 +1,166 @@
+#pragma once
+#ifndef __PETRICKS_CFG__
+#define __PETRICKS_CFG__
+
+#include <cstring>
+#include <vector>
+#include "./basics.hpp"
+
+/**
+ *  Control Flow Guard call targets of a mapped image, as listed by the GuardCFFunctionTable of its load config.
+ *  The table is sorted, so a lookup is a binary search over it in place. For hot paths guard_cf_bitmap trades
+ *  SizeOfImage / 64 bytes, built once per module, for O(1) lookups of 16-byte aligned targets.
+ *  Works on mapped images only, whether the system loaded them or memory_module did.
+ */
+
+namespace pe {
+namespace image {
+
+// the GuardCFFunctionTable in place, entries are an RVA followed by stride - 4 bytes of metadata
+class guard_cf_table {
+    const u8* _entries = nullptr;
+    size_t _count = 0;
+    size_t _stride = sizeof(u32);
+
+public:
+    guard_cf_table() {}
+    guard_cf_table(const void* entries, size_t count, size_t stride)
+        : _entries(static_cast<const u8*>(entries)), _count(count), _stride(stride) {}
+
+    size_t size() const { return _count; }
+    size_t stride() const { return _stride; }
+
+    // entries are packed, e.g. 5 bytes each, so reads are unaligned
+    u32 rva_at(size_t idx) const {
+        u32 rva;
+        memcpy(&rva, _entries + idx * _stride, sizeof(rva));
+        return rva;
+    }
+    // guard::fid_suppressed and friends, 0 when the table carries no metadata
+    u8 flags_at(size_t idx) const { return _stride > sizeof(u32) ? _entries[idx * _stride + sizeof(u32)] : 0; }
+
+    // index of the entry for rva, size() if there is none
+    size_t find(u32 rva) const {
+        size_t low = 0, high = _count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (rva_at(mid) < rva) { low = mid + 1; }
+            else { high = mid; }
+        }
+        return (low < _count && rva_at(low) == rva) ? low : _count;
+    }
+    // suppressed entries are listed too, tell them apart by flags_at
+    bool contains(u32 rva) const { return find(rva) != _count; }
+}; // class guard_cf_table
+
+// the table of an image_view32/64, empty if the image has none or it does not fit in the image
+template <typename ImageViewT>
+static inline guard_cf_table guard_cf_functions(ImageViewT& view) {
+    auto config = view.load_config();
+    if (!config || !config->covers(config->GuardFlags)) { return {}; }
+    if (!config->GuardCFFunctionTable || !config->GuardCFFunctionCount) { return {}; }
+    // the table is a VA, relocated along with ImageBase
+    u64 rva = u64(config->GuardCFFunctionTable) - u64(view.opthdr().ImageBase);
+    u64 size_of_image = view.opthdr().SizeOfImage;
+    size_t stride = sizeof(u32) + ((config->GuardFlags & guard::cf_function_table_size_mask) >> guard::cf_function_table_size_shift);
+    if (rva >= size_of_image || u64(config->GuardCFFunctionCount) > (size_of_image - rva) / stride) { return {}; }
+    return {view.template at<u8>(u32(rva)), size_t(config->GuardCFFunctionCount), stride};
+}
+
+namespace detail {
+struct guard_cf_functions_visitor {
+    template <typename ImageViewT>
+    guard_cf_table operator()(ImageViewT& view) const { return guard_cf_functions(view); }
+}; // struct guard_cf_functions_visitor
+} // namespace detail
+
+static inline guard_cf_table guard_cf_functions(void* base) {
+    return visit_image(base, detail::guard_cf_functions_visitor{});
+}
+
+/**
+ *  Two bits per 16 bytes of the image, like the bitmap the system keeps for CFG: the low one is set if the
+ *  16-byte aligned address is in the table, the high one if some other address of the 16 bytes is.
+ *  Aligned lookups are a single load, others only search the table when their 16 bytes have a target.
+ */
+class guard_cf_bitmap {
+    guard_cf_table _table;
+    std::vector<u64> _bits; // 32 slots of 16 bytes per word
+    u32 _size = 0;
+
+    u32 _slot_bits(u32 rva) const {
+        u32 slot = rva >> 4;
+        return u32(_bits[slot >> 5] >> ((slot & 31) * 2)) & 3;
+    }
+
+public:
+    guard_cf_bitmap() {}
+    guard_cf_bitmap(const guard_cf_table& table, u32 size_of_image)
+        : _table(table), _bits((size_t(size_of_image) / 16 + 32) / 32, 0), _size(size_of_image) {
+        for (size_t i = 0; i < table.size(); ++i) {
+            u32 rva = table.rva_at(i);
+            if (rva >= size_of_image) { continue; }
+            u32 slot = rva >> 4;
+            _bits[slot >> 5] |= u64((rva & 15) ? 2 : 1) << ((slot & 31) * 2);
+        }
+    }
+
+    bool empty() const { return _bits.empty(); }
+    // bytes taken by the bitmap
+    size_t memory() const { return _bits.size() * sizeof(u64); }
+
+    bool contains(u32 rva) const {
+        if (rva >= _size) { return false; }
+        u32 bits = _slot_bits(rva);
+        if (!(rva & 15)) { return bits & 1; }
+        return (bits & 2) && _table.contains(rva);
+    }
+}; // class guard_cf_bitmap
+
+/**
+ *  The CFG call targets of one mapped module, looked up by address.
+ *  A module that is not instrumented (see instrumented) has no table and contains nothing, although the system
+ *  lets calls into it through.
+ */
+class guard_cf_targets {
+    const u8* _base = nullptr;
+    u32 _size = 0;
+    u32 _flags = 0;
+    guard_cf_table _table;
+    guard_cf_bitmap _bitmap;
+
+    struct _visitor {
+        guard_cf_targets& self;
+        template <typename ImageViewT>
+        void operator()(ImageViewT& view) const {
+            self._size = view.opthdr().SizeOfImage;
+            auto config = view.load_config();
+            self._flags = (config && config->covers(config->GuardFlags)) ? config->GuardFlags : 0;
+            self._table = guard_cf_functions(view);
+        }
+    }; // struct _visitor
+
+public:
+    guard_cf_targets() {}
+    explicit guard_cf_targets(void* base) : _base(static_cast<const u8*>(base)) { visit_image(base, _visitor{*this}); }
+
+    void* base() const { return const_cast<u8*>(_base); }
+    u32 guard_flags() const { return _flags; }
+    bool instrumented() const { return (_flags & guard::cf_instrumented) != 0; }
+    const guard_cf_table& table() const { return _table; }
+
+    // makes later lookups O(1), not thread safe against concurrent lookups
+    void build_bitmap() { _bitmap = guard_cf_bitmap(_table, _size); }
+    const guard_cf_bitmap& bitmap() const { return _bitmap; }
+
+    bool contains(const void* addr) const {
+        size_t rva = reinterpret_cast<size_t>(addr) - reinterpret_cast<size_t>(_base);
+        if (!_base || rva >= _size) { return false; }
+        return _bitmap.empty() ? _table.contains(u32(rva)) : _bitmap.contains(u32(rva));
+    }
+}; // class guard_cf_targets
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_CFG__
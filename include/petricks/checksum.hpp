@@ -0,0 +1,168 @@
+#pragma once
+#ifndef __PETRICKS_CHECKSUM__
+#define __PETRICKS_CHECKSUM__
+
+#include <cstddef>
+#include "./basics.hpp"
+
+#if !defined(PETRICKS_NO_SIMD)
+#if defined(__AVX2__)
+#define PETRICKS_CHECKSUM_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PETRICKS_CHECKSUM_SSE2
+#include <emmintrin.h>
+#endif
+#endif // PETRICKS_NO_SIMD
+
+namespace pe {
+namespace image {
+
+// file offset of OptionalHeader.CheckSum, the same for PE32 and PE32+
+static inline size_t checksum_offset(const void* file) {
+    auto& doshdr = ref_at<dos_header>(file);
+    return doshdr.e_lfanew + offsetof(nt_headers, OptionalHeader) + offsetof(optional_header32, CheckSum);
+}
+
+// file offset of the security entry in the data directory, which differs between PE32 and PE32+
+static inline size_t security_dir_offset(const void* file) {
+    auto& doshdr = ref_at<dos_header>(file);
+    size_t opthdr_offset = doshdr.e_lfanew + offsetof(nt_headers, OptionalHeader);
+    size_t datadir_offset = ref_at<u16>(file, opthdr_offset) == nt_optional_hdr64_magic
+        ? offsetof(optional_header64, DataDirectory) : offsetof(optional_header32, DataDirectory);
+    return opthdr_offset + datadir_offset + size_t(directory_entry::security) * sizeof(data_directory);
+}
+
+namespace detail {
+
+/**
+ *  Sums little endian u16 words of an even-sized buffer without folding.
+ *  The one's complement sum is the sum modulo 0xFFFF, so folding once at the end gives the same result.
+ *  Vector paths split words into low and high bytes and let psadbw widen them into u64 lanes.
+ */
+static inline u64 sum_words(const u8* data, size_t size) {
+    u64 sum = 0;
+    size_t pos = 0;
+#if defined(PETRICKS_CHECKSUM_AVX2)
+    __m256i lo_acc = _mm256_setzero_si256(), hi_acc = _mm256_setzero_si256();
+    const __m256i low_mask = _mm256_set1_epi16(0x00FF), zero = _mm256_setzero_si256();
+    for (; pos + 32 <= size; pos += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        lo_acc = _mm256_add_epi64(lo_acc, _mm256_sad_epu8(_mm256_and_si256(v, low_mask), zero));
+        hi_acc = _mm256_add_epi64(hi_acc, _mm256_sad_epu8(_mm256_srli_epi16(v, 8), zero));
+    }
+    alignas(32) u64 lo_lanes[4], hi_lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lo_lanes), lo_acc);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(hi_lanes), hi_acc);
+    for (size_t i = 0; i < 4; ++i) { sum += lo_lanes[i] + (hi_lanes[i] << 8); }
+#elif defined(PETRICKS_CHECKSUM_SSE2)
+    __m128i lo_acc = _mm_setzero_si128(), hi_acc = _mm_setzero_si128();
+    const __m128i low_mask = _mm_set1_epi16(0x00FF), zero = _mm_setzero_si128();
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        lo_acc = _mm_add_epi64(lo_acc, _mm_sad_epu8(_mm_and_si128(v, low_mask), zero));
+        hi_acc = _mm_add_epi64(hi_acc, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+    }
+    alignas(16) u64 lo_lanes[2], hi_lanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lo_lanes), lo_acc);
+    _mm_store_si128(reinterpret_cast<__m128i*>(hi_lanes), hi_acc);
+    for (size_t i = 0; i < 2; ++i) { sum += lo_lanes[i] + (hi_lanes[i] << 8); }
+#endif
+    for (; pos + 2 <= size; pos += 2) { sum += u32(data[pos]) | (u32(data[pos + 1]) << 8); }
+    return sum;
+}
+
+} // namespace detail
+
+/**
+ *  Streaming OptionalHeader.CheckSum computation.
+ *  Feed the whole file in order with chunks of any size, the CheckSum field itself is treated as zero.
+ */
+class checksum {
+    u64 _sum = 0;
+    u64 _size = 0;
+    u64 _skip;
+    u8 _carry = 0;
+    bool _has_carry = false;
+
+    void _feed(const u8* data, size_t size) {
+        if (!size) { return; }
+        if (_has_carry) {
+            _sum += u32(_carry) | (u32(data[0]) << 8);
+            _has_carry = false;
+            ++data; --size;
+        }
+        _sum += detail::sum_words(data, size & ~size_t(1));
+        if (size & 1) { _carry = data[size - 1]; _has_carry = true; }
+    }
+
+public:
+    checksum(size_t checksum_field_offset) : _skip(checksum_field_offset) {}
+
+    void update(const void* data, size_t size) {
+        static const u8 zeros[sizeof(u32)] = {0, 0, 0, 0};
+        auto bytes = static_cast<const u8*>(data);
+        while (size) {
+            size_t take = size;
+            bool in_field = _size >= _skip && _size < _skip + sizeof(u32);
+            if (in_field) { take = std::min<u64>(size, _skip + sizeof(u32) - _size); }
+            else if (_size < _skip) { take = std::min<u64>(size, _skip - _size); }
+            _feed(in_field ? zeros : bytes, take);
+            bytes += take; size -= take; _size += take;
+        }
+    }
+
+    u32 finish() const {
+        u64 sum = _sum + (_has_carry ? _carry : 0);
+        while (sum >> 16) { sum = (sum & 0xFFFF) + (sum >> 16); }
+        return u32(sum + _size);
+    }
+}; // class checksum
+
+static inline u32 compute_checksum(const void* file, size_t size) {
+    checksum ck(checksum_offset(file));
+    ck.update(file, size);
+    return ck.finish();
+}
+
+/**
+ *  The byte ranges of a file in the order Authenticode hashes them:
+ *  everything except OptionalHeader.CheckSum, the security data directory entry and the certificate table.
+ *  Ranges point into the file buffer, feed them to a hasher as they are.
+ *  (Sections are hashed in file order, which is what signers produce for any well formed image.)
+ */
+class authenticode_ranges {
+    span<const u8> _ranges[4];
+    size_t _count = 0;
+
+    void _push(const u8* file, size_t first, size_t last) {
+        if (last > first) { _ranges[_count++] = {file + first, last - first}; }
+    }
+
+public:
+    authenticode_ranges(const void* file, size_t size) {
+        auto bytes = static_cast<const u8*>(file);
+        size_t checksum_pos = checksum_offset(file);
+        size_t secdir_pos = security_dir_offset(file);
+        auto& secdir = ref_at<data_directory>(file, secdir_pos);
+        // the security directory holds a file offset instead of an RVA
+        size_t cert_first = size, cert_last = size;
+        if (secdir.Size && secdir.VirtualAddress < size) {
+            cert_first = secdir.VirtualAddress;
+            cert_last = std::min<size_t>(size, size_t(secdir.VirtualAddress) + secdir.Size);
+        }
+        _push(bytes, 0, checksum_pos);
+        _push(bytes, checksum_pos + sizeof(u32), secdir_pos);
+        _push(bytes, secdir_pos + sizeof(data_directory), cert_first);
+        _push(bytes, cert_last, size); // only non-empty for files with data after the certificates
+    }
+
+    const span<const u8>* begin() const { return _ranges; }
+    const span<const u8>* end() const { return _ranges + _count; }
+    size_t size() const { return _count; }
+}; // class authenticode_ranges
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_CHECKSUM__
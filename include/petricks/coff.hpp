@@ -0,0 +1,347 @@
+#pragma once
+#ifndef __PETRICKS_COFF__
+#define __PETRICKS_COFF__
+
+#include <cstddef>
+#include <vector>
+#include "./basics.hpp"
+#include "./hashtable.hpp"
+
+/**
+ *  The COFF symbol table, read in place from a mapped file: object files (.obj), which start right at the
+ *  file_header, and images still carrying one (MinGW builds, images linked with /DEBUG:COFF).
+ *  Nothing is copied or allocated, names are string_views into the file. All accesses are bounds checked,
+ *  a damaged table reads as empty or as empty names.
+ *  Big object files (/bigobj, ANON_OBJECT_HEADER_BIGOBJ) use 20 bytes records and are not supported.
+ */
+
+namespace pe {
+namespace image {
+
+// values of symbol_record::StorageClass
+namespace symbol_class {
+constexpr u8 end_of_function = 0xFF;
+constexpr u8 null = 0;
+constexpr u8 automatic = 1;
+constexpr u8 external = 2;
+constexpr u8 static_ = 3;
+constexpr u8 register_ = 4;
+constexpr u8 external_def = 5;
+constexpr u8 label = 6;
+constexpr u8 undefined_label = 7;
+constexpr u8 member_of_struct = 8;
+constexpr u8 argument = 9;
+constexpr u8 struct_tag = 10;
+constexpr u8 member_of_union = 11;
+constexpr u8 union_tag = 12;
+constexpr u8 type_definition = 13;
+constexpr u8 undefined_static = 14;
+constexpr u8 enum_tag = 15;
+constexpr u8 member_of_enum = 16;
+constexpr u8 register_param = 17;
+constexpr u8 bit_field = 18;
+constexpr u8 block = 100;
+constexpr u8 function = 101;
+constexpr u8 end_of_struct = 102;
+constexpr u8 file = 103;
+constexpr u8 section = 104;
+constexpr u8 weak_external = 105;
+constexpr u8 clr_token = 107;
+} // namespace symbol_class
+
+// special values of symbol_record::SectionNumber, positive ones are 1-based section indices
+namespace symbol_section {
+constexpr i16 undefined = 0; // external, or common when Value is not 0
+constexpr i16 absolute = -1;
+constexpr i16 debug = -2;
+} // namespace symbol_section
+
+#pragma pack(push,2)
+struct symbol_record {
+    union {
+        u8 ShortName[sizeof_short_name]; // not terminated when all 8 are used
+        struct {
+            u32 Zeroes; // 0 for a long name
+            u32 Offset; // into the string table, counted from its size field
+        } LongName;
+    } Name;
+    u32 Value;
+    i16 SectionNumber;
+    u16 Type;
+    u8 StorageClass;
+    u8 NumberOfAuxSymbols; // records following this one that belong to it
+
+    bool has_long_name() const { return Name.LongName.Zeroes == 0; }
+    // complex type in bits 4-5: 2 is a function
+    bool is_function() const { return ((Type >> 4) & 3) == 2; }
+    bool is_defined() const { return SectionNumber > 0 || SectionNumber == symbol_section::absolute; }
+    bool is_external() const { return StorageClass == symbol_class::external || StorageClass == symbol_class::weak_external; }
+}; // struct symbol_record
+
+// the aux record of a symbol_class::external function definition
+struct aux_function_definition {
+    u32 TagIndex; // symbol index of the .bf record
+    u32 TotalSize;
+    u32 PointerToLinenumber;
+    u32 PointerToNextFunction;
+    u16 Unused;
+}; // struct aux_function_definition
+
+// the aux record of a symbol_class::weak_external
+struct aux_weak_external {
+    u32 TagIndex; // symbol index of the default definition
+    u32 Characteristics; // 1 no library search, 2 library search, 3 alias
+    u8 Unused[10];
+}; // struct aux_weak_external
+
+// the aux record of a symbol_class::static section symbol, describes the section of an object file
+struct aux_section_definition {
+    u32 Length;
+    u16 NumberOfRelocations;
+    u16 NumberOfLinenumbers;
+    u32 CheckSum;
+    u16 Number; // 1-based section index of the associated section, for associative COMDATs
+    u8 Selection; // COMDAT selection
+    u8 Unused;
+    u16 HighNumber;
+}; // struct aux_section_definition
+#pragma pack(pop)
+
+constexpr size_t sizeof_symbol_record = 18;
+static_assert(sizeof(symbol_record) == sizeof_symbol_record, "symbol records are 18 bytes");
+static_assert(sizeof(aux_function_definition) == sizeof_symbol_record, "aux records are symbol sized");
+static_assert(sizeof(aux_weak_external) == sizeof_symbol_record, "aux records are symbol sized");
+static_assert(sizeof(aux_section_definition) == sizeof_symbol_record, "aux records are symbol sized");
+
+class symbol_table_view {
+    const u8* _file = nullptr;
+    const symbol_record* _symbols = nullptr;
+    u32 _count = 0;
+    const char* _strings = nullptr; // starts with its u32 size
+    u32 _strings_size = 0; // size field included, 0 without a string table
+    const section_header* _sechdrs = nullptr;
+    u32 _section_count = 0;
+
+    void _init(const void* file, size_t size, const file_header& filehdr, size_t sechdrs_offset) {
+        _file = static_cast<const u8*>(file);
+        if (sechdrs_offset + size_t(filehdr.NumberOfSections) * sizeof(section_header) <= size) {
+            _sechdrs = ptr_at<section_header>(file, sechdrs_offset);
+            _section_count = filehdr.NumberOfSections;
+        }
+        size_t symbols_end = size_t(filehdr.PointerToSymbolTable) + size_t(filehdr.NumberOfSymbols) * sizeof_symbol_record;
+        if (!filehdr.PointerToSymbolTable || symbols_end > size) { return; }
+        _symbols = ptr_at<symbol_record>(file, filehdr.PointerToSymbolTable);
+        _count = filehdr.NumberOfSymbols;
+        // the string table directly follows the symbols, even an empty one has its size field
+        if (size - symbols_end < sizeof(u32)) { return; }
+        u32 strings_size;
+        memcpy(&strings_size, _file + symbols_end, sizeof(u32));
+        if (strings_size < sizeof(u32) || strings_size > size - symbols_end) { return; }
+        _strings = reinterpret_cast<const char*>(_file + symbols_end);
+        _strings_size = strings_size;
+    }
+
+public:
+    struct symbol {
+        u32 index;
+        const symbol_record* record;
+
+        const symbol_record& operator*() const { return *record; }
+        const symbol_record* operator->() const { return record; }
+    }; // struct symbol
+
+    // visits primary records only, aux records are skipped
+    class iterator {
+        const symbol_record* _symbols; u32 _index; u32 _count;
+    public:
+        iterator(const symbol_record* symbols, u32 index, u32 count) : _symbols(symbols), _index(index), _count(count) {}
+        symbol operator*() const { return {_index, _symbols + _index}; }
+        iterator& operator++() {
+            u32 skip = 1 + u32(_symbols[_index].NumberOfAuxSymbols);
+            _index = (_count - _index > skip) ? _index + skip : _count;
+            return *this;
+        }
+        bool operator!=(const iterator& other) const { return _index != other._index; }
+        bool operator==(const iterator& other) const { return _index == other._index; }
+    }; // class iterator
+
+    symbol_table_view() {}
+
+    // an object file, which starts with its file_header
+    static symbol_table_view of_object(const void* file, size_t size) {
+        symbol_table_view view;
+        if (size < sizeof(file_header)) { return view; }
+        auto& filehdr = ref_at<file_header>(file);
+        // anonymous and big objects start with Machine 0 and 0xFFFF where NumberOfSections is
+        if (filehdr.Machine == 0 && filehdr.NumberOfSections == 0xFFFF) { return view; }
+        view._init(file, size, filehdr, sizeof(file_header) + filehdr.SizeOfOptionalHeader);
+        return view;
+    }
+
+    // an image in file layout
+    static symbol_table_view of_image(const void* file, size_t size) {
+        symbol_table_view view;
+        if (size < sizeof(dos_header)) { return view; }
+        auto& doshdr = ref_at<dos_header>(file);
+        if (doshdr.e_magic != dos_signature) { return view; }
+        if (size_t(doshdr.e_lfanew) + sizeof(nt_headers) > size) { return view; }
+        auto& nthdr = doshdr.nthdr();
+        if (nthdr.Signature != nt_signature) { return view; }
+        view._init(file, size, nthdr.FileHeader, size_t(doshdr.e_lfanew) + offsetof(nt_headers, OptionalHeader) + nthdr.FileHeader.SizeOfOptionalHeader);
+        return view;
+    }
+
+    // either of the above, told apart by the DOS signature
+    static symbol_table_view of(const void* file, size_t size) {
+        if (size >= sizeof(u16) && ref_at<u16>(file) == dos_signature) { return of_image(file, size); }
+        return of_object(file, size);
+    }
+
+    explicit operator bool() const { return _symbols != nullptr; }
+    // records, aux ones included, as symbol indices count them
+    u32 size() const { return _count; }
+    const void* file() const { return _file; }
+
+    iterator begin() const { return {_symbols, 0, _count}; }
+    iterator end() const { return {_symbols, _count, _count}; }
+
+    // nullptr for an index past the table
+    const symbol_record* at(u32 index) const { return index < _count ? _symbols + index : nullptr; }
+
+    // the i-th aux record of the symbol at index, nullptr if it has no such record
+    template <typename AuxT>
+    const AuxT* aux(u32 index, u32 i = 0) const {
+        static_assert(sizeof(AuxT) == sizeof_symbol_record, "aux records are symbol sized");
+        if (index >= _count || i >= _symbols[index].NumberOfAuxSymbols || _count - index - 1 <= i) { return nullptr; }
+        return reinterpret_cast<const AuxT*>(_symbols + index + 1 + i);
+    }
+
+    // the terminated string at offset in the string table, empty if it is not one
+    string_view string_at(u32 offset) const {
+        if (offset < sizeof(u32) || offset >= _strings_size) { return {"", 0}; }
+        const char* first = _strings + offset;
+        const char* last = _strings + _strings_size;
+        const char* nul = std::find(first, last, 0);
+        if (nul == last) { return {"", 0}; }
+        return {first, size_t(nul - first)};
+    }
+
+    string_view name_of(const symbol_record& record) const {
+        if (record.has_long_name()) { return string_at(record.Name.LongName.Offset); }
+        auto name = reinterpret_cast<const char*>(record.Name.ShortName);
+        return {name, size_t(std::find(name, name + sizeof_short_name, 0) - name)};
+    }
+    string_view name_of(u32 index) const { return index < _count ? name_of(_symbols[index]) : string_view{"", 0}; }
+
+    // the source file name of a symbol_class::file symbol, held in its aux records and padded with zeros
+    string_view file_name_of(u32 index) const {
+        if (index >= _count || _symbols[index].StorageClass != symbol_class::file) { return {"", 0}; }
+        u32 records = std::min(u32(_symbols[index].NumberOfAuxSymbols), _count - index - 1);
+        auto name = reinterpret_cast<const char*>(_symbols + index + 1);
+        return {name, size_t(std::find(name, name + records * sizeof_symbol_record, 0) - name)};
+    }
+
+    span<const section_header> sections() const { return {_sechdrs, _section_count}; }
+
+    // the header of the section the symbol is defined in, nullptr for undefined, absolute and debug symbols
+    const section_header* section_of(const symbol_record& record) const {
+        if (record.SectionNumber <= 0 || u32(record.SectionNumber) > _section_count) { return nullptr; }
+        return _sechdrs + (record.SectionNumber - 1);
+    }
+
+    // object files spell section names longer than 8 chars as "/" and a decimal offset into the string table
+    string_view section_name_of(const section_header& sechdr) const {
+        auto name = reinterpret_cast<const char*>(sechdr.Name);
+        size_t length = std::find(name, name + sizeof_short_name, 0) - name;
+        if (length < 2 || name[0] != '/') { return {name, length}; }
+        u32 offset = 0;
+        for (size_t i = 1; i < length; ++i) {
+            if (name[i] < '0' || name[i] > '9') { return {name, length}; }
+            offset = offset * 10 + u32(name[i] - '0');
+        }
+        return string_at(offset);
+    }
+}; // class symbol_table_view
+
+/**
+ *  Name lookups over the symbol tables of many files at once, e.g. which objects define or reference a symbol.
+ *  An open addressing hash table (linear probing) from name to (file, symbol index). Names are not copied,
+ *  entries point into the views, so the files must stay mapped as long as the index is used.
+ *  A name may be present many times, in one file or in several, find visits all of its entries.
+ */
+class symbol_name_index {
+public:
+    struct match {
+        u32 file; // as returned by add
+        u32 index; // symbol index in that file
+        const symbol_record* record;
+    }; // struct match
+
+private:
+    struct _entry {
+        u32 hash;
+        u32 file; // index into _files plus one, 0 for an empty slot
+        u32 index;
+        bool empty() const { return file == 0; }
+    }; // struct _entry
+
+    pe::detail::probe_table<_entry> _slots;
+    std::vector<symbol_table_view> _files;
+
+public:
+    size_t size() const { return _slots.size(); }
+    size_t file_count() const { return _files.size(); }
+    const symbol_table_view& file(u32 id) const { return _files[id]; }
+
+    /**
+     *  Indexes the primary records of view for which pred(const symbol_record&) holds, returns the file id.
+     *  pred is called twice per record, the first pass sizes the table.
+     */
+    template <typename PredT>
+    u32 add(const symbol_table_view& view, PredT&& pred) {
+        u32 id = u32(_files.size());
+        _files.push_back(view);
+        size_t wanted = 0;
+        for (auto sym : view) { if (pred(*sym)) { ++wanted; } }
+        _slots.reserve(_slots.size() + wanted);
+        for (auto sym : view) {
+            if (!pred(*sym)) { continue; }
+            auto name = view.name_of(*sym);
+            if (!name.size()) { continue; }
+            _slots.insert(_entry{pe::detail::fnv1a(name), id + 1, sym.index});
+        }
+        return id;
+    }
+
+    // external symbols, defined or not
+    u32 add(const symbol_table_view& view) {
+        return add(view, [](const symbol_record& record) { return record.is_external(); });
+    }
+
+    // calls func(const match&) for every entry named name, stops early when func returns false
+    template <typename FuncT>
+    void find(string_view name, FuncT&& func) const {
+        _slots.probe(pe::detail::fnv1a(name), [&](size_t pos) {
+            auto& entry = _slots[pos];
+            auto& view = _files[entry.file - 1];
+            auto& record = *view.at(entry.index);
+            return !(view.name_of(record) == name) || func(match{entry.file - 1, entry.index, &record});
+        });
+    }
+
+    // the first entry named name that is defined (in a section or absolute), record is nullptr if none is
+    match find_definition(string_view name) const {
+        match found = {0, 0, nullptr};
+        find(name, [&](const match& candidate) {
+            if (!candidate.record->is_defined()) { return true; }
+            found = candidate;
+            return false;
+        });
+        return found;
+    }
+}; // class symbol_name_index
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_COFF__
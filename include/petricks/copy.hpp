@@ -0,0 +1,144 @@
+#pragma once
+#ifndef __PETRICKS_COPY__
+#define __PETRICKS_COPY__
+
+#include <cstddef>
+#include <cstring>
+#include "./basics.hpp"
+
+#if !defined(PETRICKS_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PETRICKS_COPY_SSE2
+#include <emmintrin.h>
+#endif
+#endif // PETRICKS_NO_SIMD
+
+/**
+ *  Copies for filling freshly committed memory, which the OS hands out zeroed.
+ *  Pages that would only receive zeros are left alone, so they stay untouched demand-zero pages, and big
+ *  copies bypass the cache so that mapping a multi-MB section does not evict the caller's working set.
+ */
+
+namespace pe {
+
+// copies at least this big use non-temporal stores
+constexpr size_t stream_copy_threshold = size_t(1) << 20;
+
+static inline bool all_zero(const void* data, size_t size) {
+    auto bytes = static_cast<const u8*>(data);
+    size_t pos = 0;
+    for (u64 acc = 0; pos + 64 <= size; pos += 64) {
+        u64 words[8];
+        memcpy(words, bytes + pos, sizeof(words));
+        acc = words[0] | words[1] | words[2] | words[3] | words[4] | words[5] | words[6] | words[7];
+        if (acc) { return false; }
+    }
+    for (; pos < size; ++pos) {
+        if (bytes[pos]) { return false; }
+    }
+    return true;
+}
+
+// memcpy through non-temporal stores where available, the data is not left in cache
+static inline void stream_copy(void* dest, const void* src, size_t size) {
+#if defined(PETRICKS_COPY_SSE2)
+    auto out = static_cast<u8*>(dest);
+    auto in = static_cast<const u8*>(src);
+    size_t head = (16 - (reinterpret_cast<size_t>(out) & 15)) & 15;
+    if (head >= size) { memcpy(out, in, size); return; }
+    memcpy(out, in, head);
+    size_t pos = head;
+    for (; pos + 64 <= size; pos += 64) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos + 32));
+        __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(out + pos), v0);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(out + pos + 16), v1);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(out + pos + 32), v2);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(out + pos + 48), v3);
+    }
+    for (; pos + 16 <= size; pos += 16) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(out + pos), _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + pos)));
+    }
+    // streamed stores are weakly ordered, make them visible before anyone reads the copy
+    _mm_sfence();
+    memcpy(out + pos, in + pos, size - pos);
+#else
+    memcpy(dest, src, size);
+#endif
+}
+
+/**
+ *  Copies src to dest, which must already read as zeros, skipping every page of dest that would only get zeros.
+ *  From stream_threshold bytes on the copy is streamed. Returns how many bytes were actually written.
+ */
+static inline size_t copy_to_zeroed(void* dest, const void* src, size_t size, size_t stream_threshold = stream_copy_threshold) {
+    const size_t page_size = 0x1000;
+    auto out = static_cast<u8*>(dest);
+    auto in = static_cast<const u8*>(src);
+    size_t written = 0;
+    // runs of pages with data are copied at once, so that streaming is not split at every page
+    size_t run = 0, pos = 0;
+    auto flush = [&](size_t end) {
+        if (end == run) { return; }
+        if (end - run >= stream_threshold) { stream_copy(out + run, in + run, end - run); }
+        else { memcpy(out + run, in + run, end - run); }
+        written += end - run;
+    };
+    while (pos < size) {
+        size_t next = std::min(size, (reinterpret_cast<size_t>(out + pos) | (page_size - 1)) + 1 - reinterpret_cast<size_t>(out));
+        if (all_zero(in + pos, next - pos)) {
+            flush(pos);
+            run = next;
+        }
+        pos = next;
+    }
+    flush(size);
+    return written;
+}
+
+namespace image {
+
+/**
+ *  Copies the raw data of every section of the file at file to the mapped image at base, relocating it by delta
+ *  in the same pass: each relocation block is applied right after its page is copied, while the page is still
+ *  in cache, instead of pulling every page through the cache a second time. Relocation blocks are read from
+ *  the file. Section memory must be writable and zeroed already, pages left with only zeros are not written.
+ */
+static inline void copy_sections_relocated(void* base, void* file, nt_headers& nthdr, data_directory& reloc_pos, u64 delta) {
+    auto sechdrs = nthdr.sechdrs();
+    std::vector<u32> copied(sechdrs.size(), 0); // per section, how much of the raw data is in place
+    auto copy_until = [&](size_t sec, u32 end) {
+        auto& sechdr = sechdrs[sec];
+        end = std::min(end, sechdr.SizeOfRawData);
+        if (end <= copied[sec]) { return; }
+        // not streamed, the page is about to be patched
+        copy_to_zeroed(ptr_at<void>(base, sechdr.VirtualAddress + copied[sec]), ptr_at<void>(file, sechdr.PointerToRawData + copied[sec]), end - copied[sec], size_t(-1));
+        copied[sec] = end;
+    };
+
+    size_t reloc_offset = reloc_pos.Size ? nthdr.rva_to_offset(reloc_pos.VirtualAddress) : size_t(-1);
+    size_t sec = 0;
+    for (u32 pos = 0; reloc_offset != size_t(-1) && pos + sizeof(base_relocation) <= reloc_pos.Size; ) {
+        auto& block = ref_at<base_relocation>(file, reloc_offset + pos);
+        if (block.VirtualAddress == 0 || block.SizeOfBlock < sizeof(base_relocation)) { break; }
+        pos += block.SizeOfBlock;
+        // blocks come in address order, so the section is almost always the current or the next one
+        if (sec >= sechdrs.size() || block.VirtualAddress < sechdrs[sec].VirtualAddress) { sec = 0; }
+        for (; sec < sechdrs.size(); ++sec) {
+            if (block.VirtualAddress - sechdrs[sec].VirtualAddress < std::max(sechdrs[sec].SizeOfRawData, sechdrs[sec].Misc.VirtualSize)) { break; }
+        }
+        if (sec < sechdrs.size()) {
+            // a field may straddle the end of the page, the bytes after it must be in place before it is patched
+            copy_until(sec, block.VirtualAddress - sechdrs[sec].VirtualAddress + 0x1000 + sizeof(u64));
+        }
+        apply_relocation_block(block, ptr_at<void>(base, block.VirtualAddress), delta);
+    }
+    for (size_t i = 0; i < sechdrs.size(); ++i) { copy_until(i, sechdrs[i].SizeOfRawData); }
+}
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_COPY__
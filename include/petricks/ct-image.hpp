@@ -0,0 +1,332 @@
+#pragma once
+#ifndef __PETRICKS_CT_IMAGE__
+#define __PETRICKS_CT_IMAGE__
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include "./basics.hpp"
+
+#if __cplusplus >= 202002L
+#define PETRICKS_ENABLE_CT_IMAGE
+#endif
+
+/**
+ *  constexpr parsing of a PE file held in a byte array, e.g. a DLL embedded as `static constexpr u8 dll[] = {...}`.
+ *  Layout, export and relocation tables come out as std::arrays sized by a first constexpr call:
+ *
+ *      constexpr auto sections = pe::ct::sections<pe::ct::section_count(dll)>(dll);
+ *      constexpr auto exports = pe::ct::exports<pe::ct::export_count(dll)>(dll);
+ *      constexpr auto relocs = pe::ct::relocations<pe::ct::relocation_count(dll)>(dll);
+ *
+ *  so that loading such an image at run time is copying sections and adding the delta to a flat list.
+ *  Fields are read byte by byte, in little endian, as reinterpret_cast is not allowed in constant expressions.
+ *  Reads out of bounds give zeros and malformed tables come out empty, never a compile error.
+ */
+
+#ifdef PETRICKS_ENABLE_CT_IMAGE
+namespace pe {
+namespace ct {
+
+struct bytes {
+    const u8* data = nullptr;
+    size_t size = 0;
+
+    constexpr bytes() {}
+    constexpr bytes(const u8* data_, size_t size_) : data(data_), size(size_) {}
+    template <size_t N>
+    constexpr bytes(const u8 (&array)[N]) : data(array), size(N) {}
+    template <size_t N>
+    constexpr bytes(const std::array<u8, N>& array) : data(array.data()), size(N) {}
+
+    constexpr bool has(size_t offset, size_t count) const { return offset <= size && count <= size - offset; }
+    constexpr u8 read8(size_t offset) const { return has(offset, 1) ? data[offset] : 0; }
+    constexpr u16 read16(size_t offset) const { return u16(read8(offset) | (read8(offset + 1) << 8)); }
+    constexpr u32 read32(size_t offset) const { return u32(read16(offset)) | (u32(read16(offset + 2)) << 16); }
+    constexpr u64 read64(size_t offset) const { return u64(read32(offset)) | (u64(read32(offset + 4)) << 32); }
+}; // struct bytes
+
+struct image_info {
+    bool valid = false;
+    bool is64 = false;
+    u16 machine = 0;
+    u64 image_base = 0;
+    u32 entry_point = 0;
+    u32 size_of_image = 0;
+    u32 size_of_headers = 0;
+    u32 section_alignment = 0;
+    u16 number_of_sections = 0;
+    u32 sechdr_offset = 0; // file offset of the section table
+    image::data_directory dirs[image::numberof_directory_entries] = {};
+
+    constexpr image::data_directory datadir(image::directory_entry type) const { return dirs[size_t(type)]; }
+}; // struct image_info
+
+constexpr image_info parse_image(bytes file) {
+    image_info info;
+    if (file.read16(offsetof(image::dos_header, e_magic)) != image::dos_signature) { return info; }
+    size_t nthdr = file.read32(offsetof(image::dos_header, e_lfanew));
+    if (file.read32(nthdr) != image::nt_signature) { return info; }
+    size_t filehdr = nthdr + offsetof(image::nt_headers, FileHeader);
+    size_t opthdr = nthdr + offsetof(image::nt_headers, OptionalHeader);
+    u16 magic = file.read16(opthdr);
+    if (magic != image::nt_optional_hdr32_magic && magic != image::nt_optional_hdr64_magic) { return info; }
+
+    info.is64 = magic == image::nt_optional_hdr64_magic;
+    info.machine = file.read16(filehdr + offsetof(image::file_header, Machine));
+    info.number_of_sections = file.read16(filehdr + offsetof(image::file_header, NumberOfSections));
+    info.sechdr_offset = u32(opthdr + file.read16(filehdr + offsetof(image::file_header, SizeOfOptionalHeader)));
+    // these sit at the same offset in PE32 and PE32+
+    info.entry_point = file.read32(opthdr + offsetof(image::optional_header32, AddressOfEntryPoint));
+    info.section_alignment = file.read32(opthdr + offsetof(image::optional_header32, SectionAlignment));
+    info.size_of_image = file.read32(opthdr + offsetof(image::optional_header32, SizeOfImage));
+    info.size_of_headers = file.read32(opthdr + offsetof(image::optional_header32, SizeOfHeaders));
+    size_t dirs_count, dirs_offset;
+    if (info.is64) {
+        info.image_base = file.read64(opthdr + offsetof(image::optional_header64, ImageBase));
+        dirs_count = file.read32(opthdr + offsetof(image::optional_header64, NumberOfRvaAndSizes));
+        dirs_offset = opthdr + offsetof(image::optional_header64, DataDirectory);
+    } else {
+        info.image_base = file.read32(opthdr + offsetof(image::optional_header32, ImageBase));
+        dirs_count = file.read32(opthdr + offsetof(image::optional_header32, NumberOfRvaAndSizes));
+        dirs_offset = opthdr + offsetof(image::optional_header32, DataDirectory);
+    }
+    for (size_t i = 0; i < std::min<size_t>(dirs_count, image::numberof_directory_entries); ++i) {
+        info.dirs[i] = {file.read32(dirs_offset + i * sizeof(image::data_directory)), file.read32(dirs_offset + i * sizeof(image::data_directory) + 4)};
+    }
+    info.valid = file.has(info.sechdr_offset, size_t(info.number_of_sections) * sizeof(image::section_header));
+    return info;
+}
+
+struct section {
+    char name[8] = {};
+    u32 virtual_address = 0;
+    u32 virtual_size = 0;
+    u32 raw_offset = 0;
+    u32 raw_size = 0;
+    u32 characteristics = 0;
+
+    // what a loader commits, see memory_module::section_size
+    constexpr u32 mapped_size(u32 section_alignment) const {
+        return virtual_size == 0 && raw_size == 0 ? section_alignment : std::max(virtual_size, raw_size);
+    }
+}; // struct section
+
+constexpr size_t section_count(bytes file) {
+    image_info info = parse_image(file);
+    return info.valid ? info.number_of_sections : 0;
+}
+
+constexpr section section_at(bytes file, const image_info& info, size_t idx) {
+    section sec;
+    size_t pos = info.sechdr_offset + idx * sizeof(image::section_header);
+    for (size_t i = 0; i < 8; ++i) { sec.name[i] = char(file.read8(pos + i)); }
+    sec.virtual_size = file.read32(pos + offsetof(image::section_header, Misc));
+    sec.virtual_address = file.read32(pos + offsetof(image::section_header, VirtualAddress));
+    sec.raw_size = file.read32(pos + offsetof(image::section_header, SizeOfRawData));
+    sec.raw_offset = file.read32(pos + offsetof(image::section_header, PointerToRawData));
+    sec.characteristics = file.read32(pos + offsetof(image::section_header, Characteristics));
+    return sec;
+}
+
+template <size_t N>
+constexpr std::array<section, N> sections(bytes file) {
+    std::array<section, N> layout = {};
+    image_info info = parse_image(file);
+    for (size_t i = 0; info.valid && i < N && i < info.number_of_sections; ++i) { layout[i] = section_at(file, info, i); }
+    return layout;
+}
+
+// file offset of rva, size_t(-1) if no raw data holds it
+constexpr size_t rva_to_offset(bytes file, const image_info& info, u32 rva) {
+    if (rva < info.size_of_headers) { return rva; }
+    for (size_t i = 0; i < info.number_of_sections; ++i) {
+        section sec = section_at(file, info, i);
+        if (rva >= sec.virtual_address && rva - sec.virtual_address < sec.raw_size) { return size_t(sec.raw_offset) + (rva - sec.virtual_address); }
+    }
+    return size_t(-1);
+}
+
+struct export_entry {
+    u32 name_offset = 0; // file offset of the name
+    u32 name_size = 0;
+    u32 rva = 0;
+    u32 ordinal = 0; // already biased by export_directory::Base
+    bool forwarder = false; // rva points at a "dll.name" string
+}; // struct export_entry
+
+constexpr size_t export_count(bytes file) {
+    image_info info = parse_image(file);
+    if (!info.valid || !info.datadir(image::directory_entry::export_).Size) { return 0; }
+    size_t dir = rva_to_offset(file, info, info.datadir(image::directory_entry::export_).VirtualAddress);
+    if (dir == size_t(-1) || !file.has(dir, sizeof(image::export_directory))) { return 0; }
+    return file.read32(dir + offsetof(image::export_directory, NumberOfNames));
+}
+
+namespace detail {
+
+constexpr int compare_name(bytes file, u32 offset, u32 size, const char* name, size_t name_size) {
+    for (size_t i = 0; i < size && i < name_size; ++i) {
+        u8 lhs = file.read8(offset + i), rhs = u8(name[i]);
+        if (lhs != rhs) { return lhs < rhs ? -1 : 1; }
+    }
+    return size == name_size ? 0 : (size < name_size ? -1 : 1);
+}
+
+} // namespace detail
+
+/**
+ *  Named exports sorted by name, which the export table should already be.
+ *  Keep the table together with the bytes it was parsed from, names are compared in place.
+ */
+template <size_t N>
+struct export_table {
+    bytes file;
+    std::array<export_entry, N> entries = {};
+
+    constexpr const export_entry* find(const char* name, size_t name_size) const {
+        size_t first = 0, count = N;
+        while (count > 0) {
+            size_t half = count / 2;
+            auto& mid = entries[first + half];
+            int order = detail::compare_name(file, mid.name_offset, mid.name_size, name, name_size);
+            if (order == 0) { return &mid; }
+            if (order < 0) { first += half + 1; count -= half + 1; }
+            else { count = half; }
+        }
+        return nullptr;
+    }
+    constexpr const export_entry* find(const char* name) const {
+        size_t size = 0;
+        for (; name[size]; ++size) {}
+        return find(name, size);
+    }
+    // 0 if name is not exported
+    constexpr u32 rva_of(const char* name) const {
+        auto entry = find(name);
+        return entry ? entry->rva : 0;
+    }
+    constexpr size_t size() const { return N; }
+}; // struct export_table
+
+template <size_t N>
+constexpr export_table<N> exports(bytes file) {
+    export_table<N> table;
+    table.file = file;
+    image_info info = parse_image(file);
+    auto export_pos = info.datadir(image::directory_entry::export_);
+    size_t dir = rva_to_offset(file, info, export_pos.VirtualAddress);
+    if (!info.valid || dir == size_t(-1)) { return table; }
+    size_t functions = rva_to_offset(file, info, file.read32(dir + offsetof(image::export_directory, AddressOfFunctions)));
+    size_t names = rva_to_offset(file, info, file.read32(dir + offsetof(image::export_directory, AddressOfNames)));
+    size_t ordinals = rva_to_offset(file, info, file.read32(dir + offsetof(image::export_directory, AddressOfNameOrdinals)));
+    u32 function_count = file.read32(dir + offsetof(image::export_directory, NumberOfFunctions));
+    u32 ordinal_base = file.read32(dir + offsetof(image::export_directory, Base));
+    if (functions == size_t(-1) || names == size_t(-1) || ordinals == size_t(-1)) { return table; }
+
+    for (size_t i = 0; i < N; ++i) {
+        auto& entry = table.entries[i];
+        size_t name = rva_to_offset(file, info, file.read32(names + i * 4));
+        u16 func_idx = file.read16(ordinals + i * 2);
+        if (name == size_t(-1) || func_idx >= function_count) { continue; }
+        entry.name_offset = u32(name);
+        while (file.read8(name + entry.name_size) != 0) { ++entry.name_size; }
+        entry.ordinal = ordinal_base + func_idx;
+        entry.rva = file.read32(functions + size_t(func_idx) * 4);
+        entry.forwarder = entry.rva - export_pos.VirtualAddress < export_pos.Size;
+    }
+    std::sort(table.entries.begin(), table.entries.end(), [&](const export_entry& lhs, const export_entry& rhs) {
+        for (u32 i = 0; i < lhs.name_size && i < rhs.name_size; ++i) {
+            u8 l = file.read8(lhs.name_offset + i), r = file.read8(rhs.name_offset + i);
+            if (l != r) { return l < r; }
+        }
+        return lhs.name_size < rhs.name_size;
+    });
+    return table;
+}
+
+struct relocation {
+    u32 rva = 0;
+    image::rel_based type = image::rel_based::absolute;
+    u16 param = 0; // the extra entry of highadj
+}; // struct relocation
+
+namespace detail {
+
+// calls func(rva, type, param) for every relocation but padding, returns false on a malformed table
+template <typename FuncT>
+constexpr bool for_each_relocation(bytes file, FuncT&& func) {
+    image_info info = parse_image(file);
+    auto reloc_pos = info.datadir(image::directory_entry::basereloc);
+    if (!info.valid || !reloc_pos.Size) { return true; }
+    size_t table = rva_to_offset(file, info, reloc_pos.VirtualAddress);
+    if (table == size_t(-1) || !file.has(table, reloc_pos.Size)) { return false; }
+    for (size_t pos = 0; pos + sizeof(image::base_relocation) <= reloc_pos.Size; ) {
+        u32 page = file.read32(table + pos), block_size = file.read32(table + pos + 4);
+        if (page == 0) { break; }
+        if (block_size < sizeof(image::base_relocation) || block_size > reloc_pos.Size - pos) { return false; }
+        for (size_t entry = sizeof(image::base_relocation); entry + 2 <= block_size; entry += 2) {
+            u16 value = file.read16(table + pos + entry);
+            auto type = image::rel_based(value >> 12);
+            if (type == image::rel_based::absolute) { continue; }
+            u16 param = 0;
+            if (type == image::rel_based::highadj) { entry += 2; param = file.read16(table + pos + entry); }
+            func(page + (value & 0x0FFF), type, param);
+        }
+        pos += block_size;
+    }
+    return true;
+}
+
+} // namespace detail
+
+constexpr size_t relocation_count(bytes file) {
+    size_t count = 0;
+    bool ok = detail::for_each_relocation(file, [&](u32, image::rel_based, u16) { ++count; });
+    return ok ? count : 0;
+}
+
+template <size_t N>
+constexpr std::array<relocation, N> relocations(bytes file) {
+    std::array<relocation, N> plan = {};
+    size_t count = 0;
+    detail::for_each_relocation(file, [&](u32 rva, image::rel_based type, u16 param) {
+        if (count < N) { plan[count++] = {rva, type, param}; }
+    });
+    return plan;
+}
+
+// run time halves of the plans above
+
+// copies headers and raw data to a mapped image at base, which reads as zeros beyond them
+template <size_t N>
+static inline void copy_sections(void* base, bytes file, const image_info& info, const std::array<section, N>& layout) {
+    memcpy(base, file.data, std::min<size_t>(info.size_of_headers, file.size));
+    for (auto& sec : layout) {
+        if (sec.raw_size && file.has(sec.raw_offset, sec.raw_size)) {
+            memcpy(ptr_at<void>(base, sec.virtual_address), file.data + sec.raw_offset, std::min(sec.raw_size, sec.mapped_size(info.section_alignment)));
+        }
+    }
+}
+
+template <size_t N>
+static inline void apply_relocations(void* base, const std::array<relocation, N>& plan, u64 delta) {
+    if (delta == 0) { return; }
+    for (auto& reloc : plan) {
+        auto pos = ptr_at<void>(base, reloc.rva);
+        switch (reloc.type) {
+            case image::rel_based::high: image::add_unaligned<u16>(pos, u16(u32(delta) >> 16)); break;
+            case image::rel_based::low: image::add_unaligned<u16>(pos, u16(u32(delta) & 0xFFFF)); break;
+            case image::rel_based::highlow: image::add_unaligned<u32>(pos, u32(delta)); break;
+            case image::rel_based::highadj: image::add_unaligned<u16>(pos, u16((u32(delta) + u32(reloc.param) + 0x8000) >> 16)); break;
+            case image::rel_based::dir64: image::add_unaligned<u64>(pos, delta); break;
+            default: ;
+        }
+    }
+}
+
+} // namespace ct
+} // namespace pe
+#endif // PETRICKS_ENABLE_CT_IMAGE
+
+#endif // __PETRICKS_CT_IMAGE__
@@ -0,0 +1,196 @@
+#pragma once
+#ifndef __PETRICKS_HASH__
+#define __PETRICKS_HASH__
+
+#include <cstring>
+#include "./basics.hpp"
+
+/**
+ *  Small self-contained digests, so fingerprinting does not drag in a crypto library.
+ *  All of them share the same shape: update() any number of times, then finish() once.
+ */
+
+namespace pe {
+namespace hash {
+
+class md5 {
+    u32 _state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    u64 _size = 0;
+    u8 _block[64];
+
+    static u32 _rotl(u32 x, u32 n) { return (x << n) | (x >> (32 - n)); }
+
+    void _compress(const u8* block) {
+        static const u32 k[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+        };
+        static const u32 r[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+        u32 m[16];
+        for (size_t i = 0; i < 16; ++i) {
+            m[i] = u32(block[i * 4]) | (u32(block[i * 4 + 1]) << 8) | (u32(block[i * 4 + 2]) << 16) | (u32(block[i * 4 + 3]) << 24);
+        }
+        u32 a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+        for (size_t i = 0; i < 64; ++i) {
+            u32 f, g;
+            switch (i / 16) {
+                case 0: f = (b & c) | (~b & d); g = i; break;
+                case 1: f = (d & b) | (~d & c); g = (5 * i + 1) % 16; break;
+                case 2: f = b ^ c ^ d; g = (3 * i + 5) % 16; break;
+                default: f = c ^ (b | ~d); g = (7 * i) % 16; break;
+            }
+            u32 tmp = d; d = c; c = b;
+            b = b + _rotl(a + f + k[i] + m[g], r[(i / 16) * 4 + i % 4]);
+            a = tmp;
+        }
+        _state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+    }
+
+public:
+    static constexpr size_t digest_size = 16;
+
+    void update(const void* data, size_t size) {
+        auto bytes = static_cast<const u8*>(data);
+        size_t used = _size % 64;
+        _size += size;
+        if (used) {
+            size_t take = std::min(size, 64 - used);
+            memcpy(_block + used, bytes, take);
+            bytes += take; size -= take;
+            if (used + take < 64) { return; }
+            _compress(_block);
+        }
+        for (; size >= 64; bytes += 64, size -= 64) { _compress(bytes); }
+        memcpy(_block, bytes, size);
+    }
+
+    void finish(u8* digest) {
+        u64 bits = _size * 8;
+        static const u8 pad[64] = {0x80};
+        update(pad, 1 + (119 - _size % 64) % 64);
+        u8 length[8];
+        for (size_t i = 0; i < 8; ++i) { length[i] = u8(bits >> (i * 8)); }
+        update(length, 8);
+        for (size_t i = 0; i < 16; ++i) { digest[i] = u8(_state[i / 4] >> ((i % 4) * 8)); }
+    }
+}; // class md5
+
+class sha256 {
+    u32 _state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    u64 _size = 0;
+    u8 _block[64];
+
+    static u32 _rotr(u32 x, u32 n) { return (x >> n) | (x << (32 - n)); }
+
+    void _compress(const u8* block) {
+        static const u32 k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+        u32 w[64];
+        for (size_t i = 0; i < 16; ++i) {
+            w[i] = (u32(block[i * 4]) << 24) | (u32(block[i * 4 + 1]) << 16) | (u32(block[i * 4 + 2]) << 8) | u32(block[i * 4 + 3]);
+        }
+        for (size_t i = 16; i < 64; ++i) {
+            u32 s0 = _rotr(w[i - 15], 7) ^ _rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            u32 s1 = _rotr(w[i - 2], 17) ^ _rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        u32 a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+        u32 e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+        for (size_t i = 0; i < 64; ++i) {
+            u32 t1 = h + (_rotr(e, 6) ^ _rotr(e, 11) ^ _rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            u32 t2 = (_rotr(a, 2) ^ _rotr(a, 13) ^ _rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        _state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+        _state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+    }
+
+public:
+    static constexpr size_t digest_size = 32;
+
+    void update(const void* data, size_t size) {
+        auto bytes = static_cast<const u8*>(data);
+        size_t used = _size % 64;
+        _size += size;
+        if (used) {
+            size_t take = std::min(size, 64 - used);
+            memcpy(_block + used, bytes, take);
+            bytes += take; size -= take;
+            if (used + take < 64) { return; }
+            _compress(_block);
+        }
+        for (; size >= 64; bytes += 64, size -= 64) { _compress(bytes); }
+        memcpy(_block, bytes, size);
+    }
+
+    // unlike md5, the length and the digest are big endian
+    void finish(u8* digest) {
+        u64 bits = _size * 8;
+        static const u8 pad[64] = {0x80};
+        update(pad, 1 + (119 - _size % 64) % 64);
+        u8 length[8];
+        for (size_t i = 0; i < 8; ++i) { length[i] = u8(bits >> ((7 - i) * 8)); }
+        update(length, 8);
+        for (size_t i = 0; i < 32; ++i) { digest[i] = u8(_state[i / 4] >> ((3 - i % 4) * 8)); }
+    }
+}; // class sha256
+
+/**
+ *  XXH64 in one shot, for identity keys and content hashes where speed matters more than collision resistance.
+ *  (Reads are done in host order, i.e. little endian, like the rest of this library.)
+ */
+static inline u64 xxh64(const void* data, size_t size, u64 seed = 0) {
+    const u64 p1 = 0x9E3779B185EBCA87ull, p2 = 0xC2B2AE3D27D4EB4Full, p3 = 0x165667B19E3779F9ull;
+    const u64 p4 = 0x85EBCA77C2B2AE63ull, p5 = 0x27D4EB2F165667C5ull;
+    struct op {
+        static u64 rotl(u64 x, u32 n) { return (x << n) | (x >> (64 - n)); }
+        static u64 read64(const u8* p) { u64 v; memcpy(&v, p, sizeof(v)); return v; }
+        static u32 read32(const u8* p) { u32 v; memcpy(&v, p, sizeof(v)); return v; }
+        static u64 round(u64 acc, u64 input) { return rotl(acc + input * 0xC2B2AE3D27D4EB4Full, 31) * 0x9E3779B185EBCA87ull; }
+        static u64 merge(u64 acc, u64 val) { return (acc ^ round(0, val)) * 0x9E3779B185EBCA87ull + 0x85EBCA77C2B2AE63ull; }
+    };
+    auto bytes = static_cast<const u8*>(data);
+    const u8* end = bytes + size;
+    u64 h;
+    if (size >= 32) {
+        u64 v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+        for (; end - bytes >= 32; bytes += 32) {
+            v1 = op::round(v1, op::read64(bytes));
+            v2 = op::round(v2, op::read64(bytes + 8));
+            v3 = op::round(v3, op::read64(bytes + 16));
+            v4 = op::round(v4, op::read64(bytes + 24));
+        }
+        h = op::rotl(v1, 1) + op::rotl(v2, 7) + op::rotl(v3, 12) + op::rotl(v4, 18);
+        h = op::merge(op::merge(op::merge(op::merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + p5;
+    }
+    h += size;
+    for (; end - bytes >= 8; bytes += 8) { h = op::rotl(h ^ op::round(0, op::read64(bytes)), 27) * p1 + p4; }
+    if (end - bytes >= 4) { h = op::rotl(h ^ (u64(op::read32(bytes)) * p1), 23) * p2 + p3; bytes += 4; }
+    for (; bytes < end; ++bytes) { h = op::rotl(h ^ (u64(*bytes) * p5), 11) * p1; }
+    h ^= h >> 33; h *= p2;
+    h ^= h >> 29; h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace hash
+} // namespace pe
+
+#endif // __PETRICKS_HASH__
@@ -0,0 +1,88 @@
+#pragma once
+#ifndef __PETRICKS_HASHTABLE__
+#define __PETRICKS_HASHTABLE__
+
+#include <vector>
+#include "./basics.hpp"
+
+namespace pe {
+namespace detail {
+
+// FNV-1a, for the name indexes
+static inline u32 fnv1a(string_view name) {
+    u32 hash = 0x811c9dc5;
+    for (size_t i = 0; i < name.size(); ++i) { hash = (hash ^ u8(name[i])) * 0x01000193; }
+    return hash;
+}
+
+/**
+ *  Open addressing with linear probing and backward shift deletion, over entries that carry their own u32 hash
+ *  and tell whether they are used through empty(). A value-initialized EntryT must be empty.
+ *  Keys are left to the user: probe visits every entry of a hash, the caller compares whatever it keys on.
+ */
+template <typename EntryT>
+class probe_table {
+    std::vector<EntryT> _slots; // size is 0 or a power of two
+    size_t _count = 0;
+
+    size_t _mask() const { return _slots.size() - 1; }
+
+    void _place(const EntryT& entry) {
+        size_t pos = entry.hash & _mask();
+        while (!_slots[pos].empty()) { pos = (pos + 1) & _mask(); }
+        _slots[pos] = entry;
+    }
+
+public:
+    size_t size() const { return _count; }
+    EntryT& operator[](size_t pos) { return _slots[pos]; }
+    const EntryT& operator[](size_t pos) const { return _slots[pos]; }
+
+    // makes room for count entries in total
+    void reserve(size_t count) {
+        // keep the load factor under 3/4
+        if (count * 4 <= _slots.size() * 3) { return; }
+        size_t capacity = _slots.empty() ? 64 : _slots.size();
+        while (count * 4 > capacity * 3) { capacity *= 2; }
+        std::vector<EntryT> old(capacity, EntryT());
+        old.swap(_slots);
+        for (auto& entry : old) {
+            if (!entry.empty()) { _place(entry); }
+        }
+    }
+
+    void insert(const EntryT& entry) {
+        reserve(_count + 1);
+        _place(entry);
+        ++_count;
+    }
+
+    void erase(size_t pos) {
+        // pull back later entries of the probe run so that lookups never stop early
+        size_t hole = pos;
+        for (size_t next = (hole + 1) & _mask(); !_slots[next].empty(); next = (next + 1) & _mask()) {
+            size_t home = _slots[next].hash & _mask();
+            // the entry can move into the hole if its home is not cyclically within (hole, next]
+            if (((next - home) & _mask()) >= ((next - hole) & _mask())) {
+                _slots[hole] = _slots[next];
+                hole = next;
+            }
+        }
+        _slots[hole] = EntryT();
+        --_count;
+    }
+
+    // calls func(size_t pos) for every entry with this hash until it returns false
+    template <typename FuncT>
+    void probe(u32 hash, FuncT&& func) const {
+        if (_slots.empty()) { return; }
+        for (size_t pos = hash & _mask(); !_slots[pos].empty(); pos = (pos + 1) & _mask()) {
+            if (_slots[pos].hash == hash && !func(pos)) { return; }
+        }
+    }
+}; // class probe_table
+
+} // namespace detail
+} // namespace pe
+
+#endif // __PETRICKS_HASHTABLE__
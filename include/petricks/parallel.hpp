@@ -0,0 +1,30 @@
+#pragma once
+#ifndef __PETRICKS_PARALLEL__
+#define __PETRICKS_PARALLEL__
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace pe {
+namespace detail {
+
+// runs func(index) for every index below count on up to threads threads, the calling one included
+template <typename FuncT>
+static inline void parallel_for(size_t count, size_t threads, FuncT&& func) {
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count; ) { func(i); }
+    };
+    threads = std::max<size_t>(1, std::min(threads, count));
+    std::vector<std::thread> helpers;
+    for (size_t t = 1; t < threads; ++t) { helpers.emplace_back(worker); }
+    worker();
+    for (auto& helper : helpers) { helper.join(); }
+}
+
+} // namespace detail
+} // namespace pe
+
+#endif // __PETRICKS_PARALLEL__
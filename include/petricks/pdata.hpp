@@ -0,0 +1,97 @@
+#pragma once
+#ifndef __PETRICKS_PDATA__
+#define __PETRICKS_PDATA__
+
+#include <vector>
+#include <numeric>
+#include "./basics.hpp"
+
+namespace pe {
+namespace image {
+
+/**
+ *  Resolves a batch of RVAs that is already sorted ascending.
+ *  The search window only moves forward, so the whole batch is one pass over the table.
+ *  out[i] receives the function containing rvas[i] or nullptr.
+ */
+static inline void find_runtime_functions_sorted(span<runtime_function> table, const u32* rvas, size_t count, runtime_function** out) {
+    auto pos = table.begin();
+    for (size_t i = 0; i < count; ++i) {
+        pos = std::upper_bound(pos, table.end(), rvas[i],
+            [](u32 rva, const runtime_function& func) { return rva < func.BeginAddress; }
+        );
+        out[i] = (pos != table.begin() && (pos - 1)->contains(rvas[i])) ? pos - 1 : nullptr;
+    }
+}
+
+/**
+ *  Resolves a sample buffer of instruction addresses inside the image at base.
+ *  Samples may come in any order, they are visited in address order through a sorted permutation.
+ */
+static inline void find_runtime_functions(void* base, span<runtime_function> table, const void* const* addrs, size_t count, runtime_function** out) {
+    std::vector<u32> order(count);
+    std::iota(order.begin(), order.end(), u32(0));
+    std::sort(order.begin(), order.end(), [&](u32 a, u32 b) { return addrs[a] < addrs[b]; });
+    auto pos = table.begin();
+    for (auto idx : order) {
+        size_t rva = reinterpret_cast<size_t>(addrs[idx]) - reinterpret_cast<size_t>(base);
+        if (rva > 0xFFFFFFFF) { out[idx] = nullptr; continue; } // below base or far beyond image
+        pos = std::upper_bound(pos, table.end(), u32(rva),
+            [](u32 rva, const runtime_function& func) { return rva < func.BeginAddress; }
+        );
+        out[idx] = (pos != table.begin() && (pos - 1)->contains(u32(rva))) ? pos - 1 : nullptr;
+    }
+}
+
+/**
+ *  A copy of .pdata in Eytzinger (BFS) order for hot lookups.
+ *  The first levels of the implicit tree share cache lines, and the descent is branch free.
+ */
+class runtime_function_index {
+    std::vector<runtime_function> _tree; // 1-based, _tree[0] is unused
+
+    size_t _fill(const runtime_function* sorted, size_t idx, size_t k) {
+        if (k < _tree.size()) {
+            idx = _fill(sorted, idx, 2 * k);
+            _tree[k] = sorted[idx++];
+            idx = _fill(sorted, idx, 2 * k + 1);
+        }
+        return idx;
+    }
+
+public:
+    runtime_function_index() {}
+    runtime_function_index(span<runtime_function> table) { build(table); }
+
+    void build(span<runtime_function> table) {
+        _tree.assign(table.size() + 1, runtime_function{0, 0, 0});
+        _fill(table.data(), 0, 1);
+    }
+
+    size_t size() const { return _tree.size() > 0 ? _tree.size() - 1 : 0; }
+
+    // returns a pointer into the index, not into the image
+    const runtime_function* find(u32 rva) const {
+        size_t n = size(), k = 1, found = 0;
+        while (k <= n) {
+#if defined(__GNUC__)
+            __builtin_prefetch(_tree.data() + 16 * k);
+#endif
+            bool right = _tree[k].BeginAddress <= rva;
+            found = right ? k : found;
+            k = 2 * k + right;
+        }
+        if (found == 0 || !_tree[found].contains(rva)) { return nullptr; }
+        return &_tree[found];
+    }
+
+    const runtime_function* find(void* base, const void* addr) const {
+        size_t rva = reinterpret_cast<size_t>(addr) - reinterpret_cast<size_t>(base);
+        return rva > 0xFFFFFFFF ? nullptr : find(u32(rva));
+    }
+}; // class runtime_function_index
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_PDATA__
@@ -19,6 +19,7 @@ template <typename T>
 class span {
     T* _data; size_t _size;
 public:
+    span() : _data(nullptr), _size(0) {}
     span(T* data, size_t size) : _data(data), _size(size) {}
     T* begin() const { return _data; }
     T* end() const { return _data + _size; }
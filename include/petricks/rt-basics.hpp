@@ -4,8 +4,11 @@
 
 #include "./basics.hpp"
 
-#if !defined(_WIN32) && !defined(_WIN64)
-#error This file needs win32/win64 environment!
+// calling convention of Win32 API and DLL entry points, which only means something on x86 Windows
+#if defined(_WIN32) || defined(_WIN64)
+#define PETRICKS_STDCALL __stdcall
+#else
+#define PETRICKS_STDCALL
 #endif
 
 namespace pe {
@@ -13,14 +16,14 @@ namespace runtime {
 
 using handle = void *;
 using winbool = i32;
-using winproc = size_t (__stdcall *)();
+using winproc = size_t (PETRICKS_STDCALL *)();
 
-using TyGetProcAddress = winproc __stdcall (handle hModule, const char* lpProcName);
-using TyGetModuleHandleA = handle __stdcall (const char* lpModuleName);
-using TyGetModuleHandleW = handle __stdcall (const wchar_t* lpModuleName);
-using TyLoadLibraryA = handle __stdcall (const char* lpLibFileName);
-using TyLoadLibraryW = handle __stdcall (const wchar_t* lpLibFileName);
-using TyFreeLibrary = winbool __stdcall (handle hLibModule);
+using TyGetProcAddress = winproc PETRICKS_STDCALL (handle hModule, const char* lpProcName);
+using TyGetModuleHandleA = handle PETRICKS_STDCALL (const char* lpModuleName);
+using TyGetModuleHandleW = handle PETRICKS_STDCALL (const wchar_t* lpModuleName);
+using TyLoadLibraryA = handle PETRICKS_STDCALL (const char* lpLibFileName);
+using TyLoadLibraryW = handle PETRICKS_STDCALL (const wchar_t* lpLibFileName);
+using TyFreeLibrary = winbool PETRICKS_STDCALL (handle hLibModule);
 
 namespace dll {
     constexpr u32 process_attach = 1;
@@ -30,7 +33,7 @@ namespace dll {
     constexpr u32 process_verifier = 4;
 } // namespace dll
 
-using TyDllMain = winbool __stdcall (handle hinstDLL, u32 fdwReason, void* lpvReserved);
+using TyDllMain = winbool PETRICKS_STDCALL (handle hinstDLL, u32 fdwReason, void* lpvReserved);
 
 struct memory_basic_information {
     void* BaseAddress;
@@ -101,10 +104,11 @@ namespace page {
     constexpr u32 enclave_ss_rest = enclave_mask | 2;
 } // namespace page
 
-using TyVirtualAlloc = void* __stdcall (void* lpAddress, size_t dwSize, u32 flAllocationType, u32 flProtect);
-using TyVirtualFree = winbool __stdcall (void* lpAddress, size_t dwSize, u32 dwFreeType);
-using TyVirtualQuery = size_t __stdcall (const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength);
-using TyVirtualProtect = winbool __stdcall (void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect);
+using TyVirtualAlloc = void* PETRICKS_STDCALL (void* lpAddress, size_t dwSize, u32 flAllocationType, u32 flProtect);
+using TyVirtualFree = winbool PETRICKS_STDCALL (void* lpAddress, size_t dwSize, u32 dwFreeType);
+using TyVirtualQuery = size_t PETRICKS_STDCALL (const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength);
+using TyVirtualProtect = winbool PETRICKS_STDCALL (void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect);
+using TyGetLargePageMinimum = size_t PETRICKS_STDCALL ();
 
 struct list_entry {
     list_entry *Flink;
@@ -121,7 +125,11 @@ public:
 
     class iterator {
         list_entry *_pos;
-        value_type *_real() const { return reinterpret_cast<value_type *>(_pos); }
+        // the node is not necessarily the first member, step back to the containing entry
+        value_type *_real() const {
+            size_t node_offset = reinterpret_cast<size_t>(&(reinterpret_cast<value_type *>(0)->*node_rel));
+            return reinterpret_cast<value_type *>(reinterpret_cast<u8 *>(_pos) - node_offset);
+        }
     public:
         iterator(list_entry *pos) : _pos(pos) {}
         value_type &operator*() const { return *_real(); }
@@ -148,7 +156,7 @@ struct unicode_string {
 
     wchar_t& operator[](size_t idx) { return Buffer[idx]; }
     const wchar_t& operator[](size_t idx) const { return Buffer[idx]; }
-    operator wstring_view() const { return {Buffer, Length}; }
+    operator wstring_view() const { return {Buffer, Length / sizeof(wchar_t)}; } // Length is in bytes
     
     bool operator==(const unicode_string& other) const {
         return static_cast<wstring_view>(*this) == static_cast<wstring_view>(other);
@@ -0,0 +1,197 @@
+#pragma once
+#ifndef __PETRICKS_RT_BATCH__
+#define __PETRICKS_RT_BATCH__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "./rt-loader.hpp"
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+#define PETRICKS_ENABLE_COROUTINES
+#include <coroutine>
+#endif
+
+/**
+ *  Loads many in-memory modules at once on a bounded thread pool.
+ *  Every module goes through the stages of memory_module::map as separate tasks, and workers always pick the
+ *  most advanced stage available, so modules already in flight finish before new ones start mapping and the
+ *  stages of different modules overlap. Entry points run one at a time, as under the system loader lock.
+ */
+
+namespace pe {
+namespace runtime {
+namespace loader {
+
+// a fixed set of workers serving prioritized FIFO queues, higher priority first
+class thread_pool {
+    std::mutex _lock;
+    std::condition_variable _wake, _idle;
+    std::vector<std::deque<std::function<void()>>> _queues;
+    std::vector<std::thread> _workers;
+    size_t _pending = 0; // queued or running
+    bool _stop = false;
+
+    void _work() {
+        std::unique_lock<std::mutex> guard(_lock);
+        for (;;) {
+            auto queue = _queues.rbegin();
+            for (; queue != _queues.rend() && queue->empty(); ++queue) {}
+            if (queue == _queues.rend()) {
+                if (_stop) { return; }
+                _wake.wait(guard);
+                continue;
+            }
+            auto task = std::move(queue->front());
+            queue->pop_front();
+            guard.unlock();
+            task();
+            guard.lock();
+            if (--_pending == 0) { _idle.notify_all(); }
+        }
+    }
+
+public:
+    thread_pool(size_t threads = std::thread::hardware_concurrency(), size_t priorities = 1) : _queues(priorities) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) { _workers.emplace_back([this] { _work(); }); }
+    }
+    // runs what is queued, then joins
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for (auto& worker : _workers) { worker.join(); }
+    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    size_t size() const { return _workers.size(); }
+
+    void submit(size_t priority, std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _queues[std::min(priority, _queues.size() - 1)].push_back(std::move(task));
+            ++_pending;
+        }
+        _wake.notify_one();
+    }
+    void submit(std::function<void()> task) { submit(0, std::move(task)); }
+
+    // until every task, including the ones submitted meanwhile, has run
+    void wait() {
+        std::unique_lock<std::mutex> guard(_lock);
+        _idle.wait(guard, [this] { return _pending == 0; });
+    }
+}; // class thread_pool
+
+template <typename WinApi = winapi_default>
+class batch_loader {
+public:
+    using module_type = memory_module<WinApi>;
+    using errc = typename module_type::errc;
+    using callback = std::function<void(errc)>;
+
+private:
+    enum : size_t { _map, _relocate, _bind, _protect, _attach, _stages };
+
+    struct _job {
+        module_type* module;
+        void* image;
+        callback done;
+    }; // struct _job
+
+    thread_pool _pool;
+    // entry points are run by whichever worker finds nobody running them
+    std::mutex _attach_lock;
+    std::deque<std::shared_ptr<_job>> _attach_queue;
+    bool _attaching = false;
+
+    void _run(size_t stage, std::shared_ptr<_job> job) {
+        if (stage == _attach) { _enqueue_attach(std::move(job)); return; }
+        _pool.submit(stage, [this, stage, job] {
+            errc result = errc::ok;
+            switch (stage) {
+                case _map: result = job->module->map_sections(job->image); break;
+                case _relocate: job->module->relocate(); break;
+                case _bind: result = job->module->bind_imports(); break;
+                case _protect: job->module->protect_sections(); break;
+            }
+            if (result != errc::ok) { job->module->close(); job->done(result); return; }
+            _run(stage + 1, job);
+        });
+    }
+
+    void _enqueue_attach(std::shared_ptr<_job> job) {
+        std::unique_lock<std::mutex> guard(_attach_lock);
+        _attach_queue.push_back(std::move(job));
+        if (_attaching) { return; }
+        _attaching = true;
+        while (!_attach_queue.empty()) {
+            auto next = std::move(_attach_queue.front());
+            _attach_queue.pop_front();
+            guard.unlock();
+            errc result = errc::ok;
+#if defined(_WIN32) || defined(_WIN64)
+            result = next->module->attach();
+#endif
+            next->done(result);
+            guard.lock();
+        }
+        _attaching = false;
+    }
+
+public:
+    batch_loader(size_t threads = std::thread::hardware_concurrency()) : _pool(threads, _stages) {}
+    // waits for every load in flight
+    ~batch_loader() { wait(); }
+
+    size_t threads() const { return _pool.size(); }
+
+    /**
+     *  Opens image into module in the background, done(errc) is called on a worker once it is open or failed.
+     *  module and image must stay valid until then.
+     */
+    void load(module_type& module, void* image, callback done) {
+        _run(_map, std::make_shared<_job>(_job{&module, image, std::move(done)}));
+    }
+
+    std::future<errc> load(module_type& module, void* image) {
+        auto promise = std::make_shared<std::promise<errc>>();
+        auto result = promise->get_future();
+        load(module, image, [promise](errc status) { promise->set_value(status); });
+        return result;
+    }
+
+#ifdef PETRICKS_ENABLE_COROUTINES
+    // co_await loader.load_async(module, image), the coroutine resumes on a worker
+    struct load_awaitable {
+        batch_loader* self;
+        module_type* module;
+        void* image;
+        errc result;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiting) {
+            self->load(*module, image, [this, waiting](errc status) { result = status; waiting.resume(); });
+        }
+        errc await_resume() const noexcept { return result; }
+    }; // struct load_awaitable
+
+    load_awaitable load_async(module_type& module, void* image) { return {this, &module, image, errc::ok}; }
+#endif
+
+    void wait() { _pool.wait(); }
+}; // class batch_loader
+
+} // namespace loader
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_RT_BATCH__
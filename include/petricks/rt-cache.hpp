@@ -0,0 +1,282 @@
+#pragma once
+#ifndef __PETRICKS_RT_CACHE__
+#define __PETRICKS_RT_CACHE__
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "./hash.hpp"
+#include "./rt-loader.hpp"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ *  Keeps the result of mapping an in-memory module on disk, so that later processes skip relocating and binding.
+ *  A cache file is named after the hash of the image and holds the image as it was right before its entry point
+ *  ran: relocated for the base it got then, imports bound. Its manifest records that base and the identity
+ *  (base, timestamp, size) of every dependency bound against.
+ *  A hit needs that same base to be free. Dependencies found elsewhere or changed are bound again, one import
+ *  descriptor at a time, the rest of the image is used as stored, and the cache file is rewritten with them.
+ *  Anything else, a dependency bound then but missing now included, is a miss: the image is mapped the usual
+ *  way and the cache file rewritten.
+ *  Writers never share a file: each writes its own temporary one and renames it into place. A checksum of
+ *  everything after the header catches files damaged anyway, they are misses too.
+ *  The cache directory must be trusted as much as the images themselves, its contents end up executed.
+ */
+
+namespace pe {
+namespace runtime {
+namespace loader {
+
+struct prelink_header {
+    static constexpr u32 signature = 0x4B4E4C50; // "PLNK"
+    static constexpr u32 current_version = 2;
+
+    u32 Signature;
+    u32 Version;
+    u64 ImageKey;
+    u64 ImageBase; // where the stored image is relocated to
+    u32 SizeOfImage;
+    u32 SizeOfHeaders;
+    u32 NumberOfDependencies; // prelink_dependency records following, in import descriptor order
+    u32 Reserved;
+    u64 PayloadHash; // xxh64 of the dependency records, then of each chunk below seeded with the hash so far
+    // then the headers and every section, in header order, section_size bytes each
+}; // struct prelink_header
+
+struct prelink_dependency {
+    u64 Base; // 0 if it was not found
+    u32 TimeDateStamp;
+    u32 SizeOfImage;
+
+    bool operator==(const prelink_dependency& other) const {
+        return Base == other.Base && TimeDateStamp == other.TimeDateStamp && SizeOfImage == other.SizeOfImage;
+    }
+    bool operator!=(const prelink_dependency& other) const { return !(*this == other); }
+}; // struct prelink_dependency
+
+template <typename WinApi = winapi_default>
+class prelink_cache {
+public:
+    using module_type = memory_module<WinApi>;
+    using errc = typename module_type::errc;
+
+    struct statistics {
+        size_t hits;
+        size_t misses;
+        size_t stores; // cache files written
+        size_t rebinds; // import descriptors bound again on hits
+        double hit_seconds; // spent in opens that hit, validation included
+        double miss_seconds; // ... that missed, writing the cache included
+        double validate_seconds; // checking and rebinding dependencies on hits
+    }; // struct statistics
+
+private:
+    using clock = std::chrono::steady_clock;
+    // more import descriptors than this means a damaged file
+    static constexpr u32 _max_dependencies = 0x10000;
+
+    std::string _directory;
+    statistics _stats = {0, 0, 0, 0, 0, 0, 0};
+
+    static double _seconds_since(clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    static prelink_dependency _identity(typename module_type::dependency dep) {
+        prelink_dependency id = {reinterpret_cast<size_t>(dep.module), 0, 0};
+        if (!dep.module) { return id; }
+        auto& doshdr = *reinterpret_cast<image::dos_header*>(dep.module);
+        if (doshdr.e_magic != image::dos_signature || doshdr.nthdr().Signature != image::nt_signature) { return id; }
+        id.TimeDateStamp = doshdr.nthdr().FileHeader.TimeDateStamp;
+        id.SizeOfImage = doshdr.nthdr().OptionalHeader.local.SizeOfImage;
+        return id;
+    }
+
+    static unsigned long _process_id() {
+#if defined(_WIN32) || defined(_WIN64)
+        return static_cast<unsigned long>(_getpid());
+#else
+        return static_cast<unsigned long>(getpid());
+#endif
+    }
+
+    struct _file {
+        FILE* ptr;
+        _file(const std::string& path, const char* mode) : ptr(fopen(path.c_str(), mode)) {}
+        ~_file() { if (ptr) { fclose(ptr); } }
+        bool read(void* data, size_t size) { return fread(data, 1, size, ptr) == size; }
+        bool write(const void* data, size_t size) { return fwrite(data, 1, size, ptr) == size; }
+    }; // struct _file
+
+    // the stored headers and sections, as laid out after the manifest
+    template <typename FuncT>
+    static bool _for_each_chunk(void* base, u32 size_of_headers, FuncT&& func) {
+        if (!func(base, size_t(size_of_headers))) { return false; }
+        auto& nthdr = reinterpret_cast<image::dos_header*>(base)->nthdr();
+        for (auto& sechdr : nthdr.sechdrs()) {
+            if (!func(ptr_at<void>(base, sechdr.VirtualAddress), size_t(module_type::section_size(sechdr, nthdr.OptionalHeader.local)))) { return false; }
+        }
+        return true;
+    }
+
+    // xxh64 chained over the pieces of the payload, in file order
+    static u64 _payload_hash(const std::vector<prelink_dependency>& deps, void* base, u32 size_of_headers) {
+        u64 hash = hash::xxh64(deps.data(), deps.size() * sizeof(prelink_dependency));
+        _for_each_chunk(base, size_of_headers, [&](void* data, size_t size) { hash = hash::xxh64(data, size, hash); return true; });
+        return hash;
+    }
+
+    template <typename ResolverT>
+    bool _load(module_type& module, u64 key, ResolverT& resolver) {
+        _file file(path_of(key), "rb");
+        if (!file.ptr) { return false; }
+        prelink_header header;
+        if (!file.read(&header, sizeof(header))) { return false; }
+        if (header.Signature != prelink_header::signature || header.Version != prelink_header::current_version) { return false; }
+        if (header.ImageKey != key || header.ImageBase != u64(size_t(header.ImageBase))) { return false; }
+        if (header.NumberOfDependencies > _max_dependencies) { return false; }
+        std::vector<prelink_dependency> deps(header.NumberOfDependencies);
+        if (!deps.empty() && !file.read(deps.data(), deps.size() * sizeof(prelink_dependency))) { return false; }
+
+        if (module.map_prebuilt(reinterpret_cast<void*>(size_t(header.ImageBase)), header.SizeOfImage) != errc::ok) { return false; }
+        void* base = module.base_addr();
+        // headers are checked once read, before their section table is trusted
+        u64 payload_hash = hash::xxh64(deps.data(), deps.size() * sizeof(prelink_dependency));
+        bool complete = _for_each_chunk(base, header.SizeOfHeaders, [&](void* data, size_t size) {
+            if (ptr_at<u8>(data, size) > ptr_at<u8>(base, header.SizeOfImage) || !file.read(data, size)) { return false; }
+            payload_hash = hash::xxh64(data, size, payload_hash);
+            if (data != base) { return true; }
+            auto& doshdr = *reinterpret_cast<image::dos_header*>(base);
+            return size >= sizeof(image::dos_header) && doshdr.e_magic == image::dos_signature
+                && doshdr.e_lfanew + sizeof(image::nt_headers) <= size
+                && doshdr.nthdr().Signature == image::nt_signature && doshdr.nthdr().machine() == image::file_machine::local
+                && doshdr.nthdr().OptionalHeader.local.ImageBase == size_t(header.ImageBase);
+        });
+        if (!complete || payload_hash != header.PayloadHash) { module.discard(); return false; }
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base)->nthdr().OptionalHeader.local;
+        size_t import_count = 0;
+        for (auto& import_desc : image::imports_view(loaded_opthdr)) { (void)import_desc; ++import_count; }
+        if (import_count != deps.size()) { module.discard(); return false; }
+
+        auto validate_start = clock::now();
+        std::vector<typename module_type::dependency> loaded;
+        std::vector<prelink_dependency> current;
+        loaded.reserve(deps.size());
+        current.reserve(deps.size());
+        size_t rebinds = 0;
+        for (auto& import_desc : image::imports_view(loaded_opthdr)) {
+            auto dep = module.load_dependency(import_desc, resolver);
+            auto& stored = deps[current.size()];
+            current.push_back(_identity(dep));
+            if (!dep.module && stored.Base) {
+                // the IAT still points into where it was found then, which is a miss
+                for (auto& prev : loaded) { module.release_dependency(prev); }
+                module.discard();
+                _stats.validate_seconds += _seconds_since(validate_start);
+                return false;
+            }
+            loaded.push_back(dep);
+            if (current.back() != stored && dep.module) {
+                module.bind_dependency(import_desc, dep);
+                ++rebinds;
+            }
+        }
+        _stats.rebinds += rebinds;
+        _stats.validate_seconds += _seconds_since(validate_start);
+        // so that later processes do not bind the same descriptors again
+        if (rebinds && _store(module, key, current)) { ++_stats.stores; }
+        return true;
+    }
+
+    bool _store(module_type& module, u64 key, const std::vector<prelink_dependency>& deps) {
+        void* base = module.base_addr();
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base)->nthdr().OptionalHeader.local;
+        prelink_header header = {
+            prelink_header::signature, prelink_header::current_version, key, u64(loaded_opthdr.ImageBase),
+            loaded_opthdr.SizeOfImage, loaded_opthdr.SizeOfHeaders, u32(deps.size()), 0,
+            _payload_hash(deps, base, loaded_opthdr.SizeOfHeaders),
+        };
+        // written aside under a name no other writer uses and renamed into place, so that a reader never sees half a file
+        static std::atomic<u32> temp_count(0);
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", _process_id(), unsigned(temp_count.fetch_add(1)));
+        std::string path = path_of(key), temp = path + suffix;
+        bool complete;
+        {
+            _file file(temp, "wbx");
+            if (!file.ptr) { return false; }
+            complete = file.write(&header, sizeof(header))
+                && (deps.empty() || file.write(deps.data(), deps.size() * sizeof(prelink_dependency)))
+                && _for_each_chunk(base, header.SizeOfHeaders, [&](void* data, size_t size) { return file.write(data, size); });
+        }
+        if (!complete) { std::remove(temp.c_str()); return false; }
+        std::remove(path.c_str());
+        if (std::rename(temp.c_str(), path.c_str()) != 0) { std::remove(temp.c_str()); return false; }
+        return true;
+    }
+
+public:
+    // directory must exist
+    prelink_cache(std::string directory) : _directory(std::move(directory)) {}
+
+    static u64 key_of(const void* image, size_t size) { return hash::xxh64(image, size); }
+    std::string path_of(u64 key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.prelink", static_cast<unsigned long long>(key));
+        return _directory + "/" + name;
+    }
+
+    const statistics& stats() const { return _stats; }
+    void reset_stats() { _stats = {0, 0, 0, 0, 0, 0, 0}; }
+
+    /**
+     *  Opens image into module like memory_module::open, from the cache file of key if it is usable.
+     *  resolver works as for memory_module::map, in-memory dependencies are checked like any other.
+     *  Not thread safe, give each thread its own prelink_cache over the same directory.
+     */
+    template <typename ResolverT = no_import_resolver>
+    errc open(module_type& module, u64 key, void* image, ResolverT&& resolver = {}) {
+        auto start = clock::now();
+        bool hit = _load(module, key, resolver);
+        if (!hit) {
+            errc result = module.map_sections(image);
+            if (result != errc::ok) { return result; }
+            module.relocate();
+            std::vector<prelink_dependency> deps;
+            auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(module.base_addr())->nthdr().OptionalHeader.local;
+            for (auto& import_desc : image::imports_view(loaded_opthdr)) {
+                auto dep = module.load_dependency(import_desc, resolver);
+                if (!dep.module) { module.close(); return errc::import_fail; }
+                module.bind_dependency(import_desc, dep);
+                deps.push_back(_identity(dep));
+            }
+            if (_store(module, key, deps)) { ++_stats.stores; }
+        }
+        module.protect_sections();
+        if (hit) { ++_stats.hits; _stats.hit_seconds += _seconds_since(start); }
+        else { ++_stats.misses; _stats.miss_seconds += _seconds_since(start); }
+#if defined(_WIN32) || defined(_WIN64)
+        return module.attach();
+#else
+        return errc::ok;
+#endif
+    }
+
+    template <typename ResolverT = no_import_resolver>
+    errc open(module_type& module, void* image, size_t size, ResolverT&& resolver = {}) {
+        return open(module, key_of(image, size), image, resolver);
+    }
+}; // class prelink_cache
+
+} // namespace loader
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_RT_CACHE__
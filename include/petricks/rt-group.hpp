@@ -0,0 +1,175 @@
+#pragma once
+#ifndef __PETRICKS_RT_GROUP__
+#define __PETRICKS_RT_GROUP__
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "./parallel.hpp"
+#include "./rt-loader.hpp"
+
+/**
+ *  Loads a set of in-memory modules that import from each other.
+ *  Binding an import only needs the exporting module mapped, not initialized, so every module is mapped and
+ *  relocated in parallel, then imports are bound and sections protected in parallel, and the dependency graph
+ *  only orders the entry points: dependencies attach first, cycles are broken the way the system loader does,
+ *  at the edge that closes them.
+ */
+
+namespace pe {
+namespace runtime {
+namespace loader {
+
+namespace detail {
+using pe::detail::parallel_for;
+} // namespace detail
+
+template <typename WinApi = winapi_default>
+class module_group {
+public:
+    using module_type = memory_module<WinApi>;
+    using errc = typename module_type::errc;
+
+private:
+    struct _node {
+        const char* name;
+        void* image;
+        std::unique_ptr<module_type> module;
+        std::vector<size_t> deps; // in-group dependencies
+    }; // struct _node
+
+    WinApi _api;
+    std::vector<_node> _nodes;
+    std::vector<size_t> _order; // initialization order, dependencies first
+    size_t _failed = size_t(-1);
+
+    size_t _index_of(const char* dll_name) const {
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            if (reflect::dll_name_cmp<char, char>(_nodes[i].name, dll_name)) { return i; }
+        }
+        return size_t(-1);
+    }
+
+    // the in-group dependencies of every node, read from the file layout of its import table
+    void _build_graph() {
+        for (auto& node : _nodes) {
+            node.deps.clear();
+            auto& nthdr = reinterpret_cast<image::dos_header*>(node.image)->nthdr();
+            if (nthdr.machine() != image::file_machine::local) { continue; }
+            auto& import_pos = nthdr.OptionalHeader.local.datadir(image::directory_entry::import_);
+            if (!import_pos.Size) { continue; }
+            size_t offset = nthdr.rva_to_offset(import_pos.VirtualAddress);
+            if (offset == size_t(-1)) { continue; }
+            for (auto& import_desc : sentinel_view<image::import_descriptor>(ptr_at<image::import_descriptor>(node.image, offset))) {
+                size_t name_offset = nthdr.rva_to_offset(import_desc.Name);
+                if (name_offset == size_t(-1)) { continue; }
+                size_t dep = _index_of(ptr_at<char>(node.image, name_offset));
+                if (dep != size_t(-1) && dep != size_t(&node - _nodes.data())) { node.deps.push_back(dep); }
+            }
+        }
+    }
+
+    // depth first post order, an edge back into the current path is skipped
+    void _build_order() {
+        enum : u8 { unvisited, visiting, done };
+        std::vector<u8> mark(_nodes.size(), unvisited);
+        std::vector<std::pair<size_t, size_t>> stack; // node, next dependency to visit
+        _order.clear();
+        for (size_t root = 0; root < _nodes.size(); ++root) {
+            if (mark[root] != unvisited) { continue; }
+            stack.emplace_back(root, 0); mark[root] = visiting;
+            while (!stack.empty()) {
+                auto& top = stack.back();
+                auto& deps = _nodes[top.first].deps;
+                if (top.second < deps.size()) {
+                    size_t dep = deps[top.second++];
+                    if (mark[dep] == unvisited) { mark[dep] = visiting; stack.emplace_back(dep, 0); }
+                } else {
+                    mark[top.first] = done;
+                    _order.push_back(top.first);
+                    stack.pop_back();
+                }
+            }
+        }
+    }
+
+public:
+    module_group(const WinApi& api = {}) : _api(api) {}
+    ~module_group() { close(); }
+
+    // name is what importers ask for, e.g. "foo.dll", both name and image must outlive open()
+    size_t add(const char* name, void* image) {
+        _nodes.push_back({name, image, nullptr, {}});
+        return _nodes.size() - 1;
+    }
+
+    size_t size() const { return _nodes.size(); }
+    module_type& operator[](size_t idx) { return *_nodes[idx].module; }
+    module_type* find(const char* dll_name) {
+        size_t idx = _index_of(dll_name);
+        return idx == size_t(-1) ? nullptr : _nodes[idx].module.get();
+    }
+    const std::vector<size_t>& order() const { return _order; }
+    // the node whose failure stopped open()
+    size_t failed() const { return _failed; }
+
+    /**
+     *  Maps every module, binding imports between them, then runs entry points in dependency order
+     *  (on Windows). On failure everything opened so far is closed, or only unmapped if it was not bound yet,
+     *  and failed() tells which node it was.
+     */
+    errc open(size_t threads = std::thread::hardware_concurrency()) {
+        _build_graph();
+        _build_order();
+        for (auto& node : _nodes) { node.module.reset(new module_type(_api)); }
+        std::vector<errc> results(_nodes.size(), errc::ok);
+
+        detail::parallel_for(_nodes.size(), threads, [&](size_t i) {
+            results[i] = _nodes[i].module->map_sections(_nodes[i].image);
+            if (results[i] == errc::ok) { _nodes[i].module->relocate(); }
+        });
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            if (results[i] != errc::ok) {
+                // nothing is bound yet, close() would free libraries these never loaded
+                for (auto& node : _nodes) { node.module->discard(); }
+                _failed = i;
+                return results[i];
+            }
+        }
+
+        auto resolver = [&](const char* dll_name) -> void* {
+            size_t dep = _index_of(dll_name);
+            return dep == size_t(-1) ? nullptr : _nodes[dep].module->base_addr();
+        };
+        detail::parallel_for(_nodes.size(), threads, [&](size_t i) {
+            results[i] = _nodes[i].module->bind_imports(resolver);
+            if (results[i] == errc::ok) { _nodes[i].module->protect_sections(); }
+        });
+        for (size_t i = 0; i < _nodes.size(); ++i) {
+            if (results[i] != errc::ok) { _failed = i; close(); return results[i]; }
+        }
+
+#if defined(_WIN32) || defined(_WIN64)
+        for (size_t i : _order) {
+            errc result = _nodes[i].module->attach();
+            if (result != errc::ok) { _failed = i; close(); return result; }
+        }
+#endif
+        _failed = size_t(-1);
+        return errc::ok;
+    }
+
+    // detaches and frees in reverse initialization order
+    void close() {
+        for (size_t i = _order.size(); i-- > 0; ) {
+            if (_nodes[_order[i]].module) { _nodes[_order[i]].module->close(); }
+        }
+    }
+}; // class module_group
+
+} // namespace loader
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_RT_GROUP__
@@ -1,28 +1,63 @@
+#pragma once
+#ifndef __PETRICKS_RT_LOADER__
+#define __PETRICKS_RT_LOADER__
+
+#include <string>
+#include "./copy.hpp"
 #include "./rt-basics.hpp"
 #include "./rt-reflect.hpp"
 #include "./rt-winapi.hpp"
-
-#if !defined(_WIN32) && !defined(_WIN64)
-#error This file needs win32/win64 environment!
-#endif
+#include "./unmap.hpp"
 
 namespace pe {
 namespace runtime {
 namespace loader {
 
+// binds every import with LoadLibraryA
+struct no_import_resolver {
+    void* operator()(const char*) const { return nullptr; }
+}; // struct no_import_resolver
+
+namespace alloc_policy {
+    constexpr u32 normal = 0;
+    /**
+     *  Back the whole image with large pages (committed at once, anywhere), normal pages if they cannot be had.
+     *  Protection cannot be changed below the large page size, so such an image stays read-write-execute as a
+     *  whole and its discardable sections stay committed.
+     */
+    constexpr u32 large_pages = 1;
+    // fault every section in while mapping, instead of page by page on first use
+    constexpr u32 prefault = 2;
+    // when the image cannot have its preferred base, relocate each page right after copying it, in one pass
+    constexpr u32 fused_relocation = 4;
+} // namespace alloc_policy
+
 template <typename WinApi = winapi_default>
 #ifdef PETRICKS_ENABLE_CONCEPTS
     requires winapi_provider<WinApi>
 #endif
 class memory_module {
     ebco_pair<WinApi, void*> _impl;
+    bool _attached = false;
+    bool _large_pages = false;
+    u32 _policy = alloc_policy::normal;
+    const reflect::api_set_map* _api_sets = nullptr;
 
 public:
     memory_module(const WinApi& api = {}) : _impl(api, nullptr) {}
+    memory_module(const WinApi& api, u32 policy) : _impl(api, nullptr), _policy(policy) {}
     ~memory_module() { close(); }
 
     const WinApi& api() const { return _impl.first(); }
     void* base_addr() const { return _impl.second(); }
+    // alloc_policy flags for the next map
+    u32 policy() const { return _policy; }
+    void policy(u32 flags) { _policy = flags; }
+    // whether the current mapping got large pages
+    bool large_pages() const { return _large_pages; }
+    // the API set schema imports of contracts are resolved through, nullptr for the one of the process (Windows only)
+    const reflect::api_set_map* api_sets() const { return _api_sets; }
+    void api_sets(const reflect::api_set_map* map) { _api_sets = map; }
     operator bool() { return bool(base_addr()); }
 
     enum class errc {
@@ -31,6 +66,7 @@ public:
         arch_mismatch, // file architecture does not match current program
         alloc_fail, // cannot allocate needed memory
         attach_fail, // entry returns FALSE
+        import_fail, // a dependency cannot be loaded
     }; // enum class errc
 
     TyDllMain* entry() {
@@ -40,7 +76,31 @@ public:
         return loaded_opthdr.AddressOfEntryPoint ? ptr_at<TyDllMain>(base_addr, loaded_opthdr.AddressOfEntryPoint) : nullptr;
     }
 
-    errc open(void* image) {
+    /**
+     *  Maps the image, applies relocations, binds imports and sets section protection,
+     *  i.e. everything but running the entry point, which only makes sense on Windows.
+     *  resolver(const char* dll_name) may return the base of another in-memory module to bind against,
+     *  or nullptr to load the dependency with LoadLibraryA.
+     */
+    template <typename ResolverT = no_import_resolver>
+    errc map(void* image, ResolverT&& resolver = {}) {
+        errc result = map_sections(image);
+        if (result != errc::ok) { return result; }
+        relocate();
+        result = bind_imports(resolver);
+        if (result != errc::ok) { close(); return result; }
+        protect_sections();
+        return errc::ok;
+    }
+
+    // the stages of map(), one at a time
+
+    /**
+     *  Reserves the image and copies headers and sections, ImageBase keeps the preferred base until relocate().
+     *  Under alloc_policy::fused_relocation the sections are relocated while being copied instead, and ImageBase
+     *  is already the actual base, leaving nothing for relocate() to do.
+     */
+    errc map_sections(void* image) {
         WinApi& api = _impl.first();
         void*& base_addr = _impl.second();
 
@@ -53,87 +113,218 @@ public:
         auto& opthdr = nthdr.OptionalHeader.local;
 
         // allocate module memory
-        base_addr = api.VirtualAlloc(reinterpret_cast<void*>(opthdr.ImageBase), opthdr.SizeOfImage, mem::reserve, page::readwrite);
+        base_addr = nullptr;
+        _large_pages = false;
+        _bindings.clear();
+        size_t large_page_size = (_policy & alloc_policy::large_pages) ? size_t(api.GetLargePageMinimum()) : 0;
+        if (large_page_size) {
+            // large pages come committed, and executable since protection may not be changeable below their size
+            size_t large_size = (size_t(opthdr.SizeOfImage) + large_page_size - 1) & ~(large_page_size - 1);
+            base_addr = api.VirtualAlloc(nullptr, large_size, mem::reserve | mem::commit | mem::large_pages, page::execute_readwrite);
+            _large_pages = base_addr != nullptr;
+        }
+        if (!base_addr) { base_addr = api.VirtualAlloc(reinterpret_cast<void*>(opthdr.ImageBase), opthdr.SizeOfImage, mem::reserve, page::readwrite); }
         if (!base_addr) { base_addr = api.VirtualAlloc(nullptr, opthdr.SizeOfImage, mem::reserve, page::readwrite); }
         if (!base_addr) { return errc::alloc_fail; }
-        size_t reloc_offset = reinterpret_cast<size_t>(base_addr) - opthdr.ImageBase;
+        auto commit = [&](void* addr, size_t size) {
+            return _large_pages ? addr : api.VirtualAlloc(addr, size, mem::commit, page::readwrite);
+        };
+
+        u64 delta = u64(reinterpret_cast<size_t>(base_addr) - opthdr.ImageBase);
+        bool fused = (_policy & alloc_policy::fused_relocation) && delta != 0;
 
-        // copy headers and set real module base
-        api.VirtualAlloc(base_addr, opthdr.SizeOfHeaders, mem::commit, page::readwrite);
+        // a commit that fails leaves nothing behind, like relocate_to
+        auto fail = [&]() {
+            api.VirtualFree(base_addr, 0, mem::release);
+            base_addr = nullptr;
+            _large_pages = false;
+            return errc::alloc_fail;
+        };
+
+        // copy headers
+        if (!commit(base_addr, opthdr.SizeOfHeaders)) { return fail(); }
         memcpy(base_addr, image, opthdr.SizeOfHeaders);
-        auto& loaded_nthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr();
-        auto& loaded_opthdr = loaded_nthdr.OptionalHeader.local;
-        loaded_opthdr.ImageBase = reinterpret_cast<size_t>(base_addr);
 
-        // copy sections
+        // copy sections, freshly committed memory is zeroed so neither .bss nor tails past the raw data are written
         for (auto& sechdr : nthdr.sechdrs()) {
-            auto sec_addr = ptr_at<void>(base_addr, sechdr.VirtualAddress);
-            if (sechdr.SizeOfRawData == 0) {
-                if (opthdr.SectionAlignment != 0) {
-                    void* empty_sec = api.VirtualAlloc(sec_addr, opthdr.SectionAlignment, mem::commit, page::readwrite);
-                    memset(empty_sec, 0, opthdr.SectionAlignment);
-                }
-            } else {
-                void* section = api.VirtualAlloc(sec_addr, sechdr.SizeOfRawData, mem::commit, page::readwrite);
-                memcpy(section, ptr_at<void>(image, sechdr.PointerToRawData), sechdr.SizeOfRawData);
+            u32 mapped_size = section_size(sechdr, opthdr);
+            if (mapped_size == 0) { continue; }
+            auto section = static_cast<u8*>(commit(ptr_at<void>(base_addr, sechdr.VirtualAddress), mapped_size));
+            if (!section) { return fail(); }
+            if (!fused && sechdr.SizeOfRawData != 0) {
+                copy_to_zeroed(section, ptr_at<void>(image, sechdr.PointerToRawData), sechdr.SizeOfRawData);
+            }
+            if (_policy & alloc_policy::prefault) {
+                auto first = reinterpret_cast<volatile u8*>(section);
+                for (size_t pos = 0; pos < mapped_size; pos += 0x1000) { first[pos] = first[pos]; }
             }
         }
 
-        // handle relocation
-        if (reloc_offset != 0) {
-            for (auto& reloc_base : image::basereloc_view(loaded_opthdr)) {
-                bool is_highadj_param = false;
-                for (auto& reloc : reloc_base.entries()) {
-                    // skip this if last is highadj
-                    if (is_highadj_param) { is_highadj_param = false; continue; }
-                    // Note: for most modules, only highlow and dir64 is used.
-                    auto patch_pos = ptr_at<void>(base_addr, reloc_base.VirtualAddress + reloc.offset());
-                    switch (reloc.flag()) {
-                        case image::rel_based::absolute: break;
-                        case image::rel_based::high: {
-                            ref_at<u16 __unaligned>(patch_pos) += u32(reloc_offset) >> 16;
-                        } break;
-                        case image::rel_based::low: {
-                            ref_at<u16 __unaligned>(patch_pos) += u32(reloc_offset) & 0xFFFF;
-                        } break;
-                        case image::rel_based::highlow: {
-                            ref_at<u32 __unaligned>(patch_pos) += u32(reloc_offset);
-                        } break;
-                        case image::rel_based::highadj: {
-                            // I just cannot understand what microsoft said on this in documentation.
-                            // You may hope sane compilers never use this.
-                            // The following is based on: https://github.com/BHTY/EmuWoW/blob/main/pe.c#L121-L127
-                            u32 wtf = u32(reloc_offset) + u32(reloc.highadj_param()) + 0x8000;
-                            ref_at<u16 __unaligned>(patch_pos) += u16(wtf >> 16);
-                            is_highadj_param = true;
-                        } break;
-                        case image::rel_based::dir64: {
-                            ref_at<u64 __unaligned>(patch_pos) += reloc_offset;
-                        } break;
-                        default: ; // skips unknown reloc 
-                    }
-                }
-            }
+        if (fused) {
+            image::copy_sections_relocated(base_addr, image, nthdr, opthdr.datadir(image::directory_entry::basereloc), delta);
+            reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local.ImageBase = reinterpret_cast<size_t>(base_addr);
         }
+        return errc::ok;
+    }
+
+    // what map_sections commits for a section: its virtual size, the raw data may run past it up to the file alignment
+    static u32 section_size(image::section_header& sechdr, image::optional_header& opthdr) {
+        if (sechdr.Misc.VirtualSize == 0 && sechdr.SizeOfRawData == 0) { return opthdr.SectionAlignment; }
+        return std::max(sechdr.Misc.VirtualSize, sechdr.SizeOfRawData);
+    }
+
+    /**
+     *  Instead of map_sections, for an image that was mapped, relocated and bound before (e.g. by a cache):
+     *  reserves size bytes at exactly base and commits them, to be filled through base_addr().
+     */
+    errc map_prebuilt(void* base, size_t size) {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        _large_pages = false;
+        _bindings.clear();
+        base_addr = api.VirtualAlloc(base, size, mem::reserve, page::readwrite);
+        if (base_addr && base_addr != base) { api.VirtualFree(base_addr, 0, mem::release); base_addr = nullptr; }
+        if (!base_addr) { return errc::alloc_fail; }
+        api.VirtualAlloc(base_addr, size, mem::commit, page::readwrite);
+        return errc::ok;
+    }
+
+    // applies relocations for the actual base and sets it as ImageBase
+    void relocate() {
+        void*& base_addr = _impl.second();
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+        image::apply_relocations(base_addr, loaded_opthdr, reinterpret_cast<size_t>(base_addr) - loaded_opthdr.ImageBase);
+        loaded_opthdr.ImageBase = reinterpret_cast<size_t>(base_addr);
+    }
+
+    // stops at the first dependency that cannot be loaded, close() gives back the ones loaded until then
+    template <typename ResolverT = no_import_resolver>
+    errc bind_imports(ResolverT&& resolver = {}) {
+        void*& base_addr = _impl.second();
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
 
-        // import dependencies
         for (auto& import_desc : image::imports_view(loaded_opthdr)) {
-            handle depmod = api.LoadLibraryA(ptr_at<char>(base_addr, import_desc.Name));
-            if (!depmod) { continue; }
-            auto lookup_table = ptr_at<image::thunk_data>(base_addr, import_desc.OriginalFirstThunk);
-            auto address_table = ptr_at<image::thunk_data>(base_addr, import_desc.FirstThunk);
-            for (size_t i = 0; !lookup_table[i].termination(); ++i) {
-                char* name = lookup_table[i].flag()
-                    ? reinterpret_cast<char*>(address_table[i].ordinal())
-                    : ref_at<image::import_by_name>(base_addr, lookup_table[i].name_rva()).Name;
-                address_table[i].value = reinterpret_cast<size_t>(api.GetProcAddress(depmod, name));
+            dependency dep = load_dependency(import_desc, resolver);
+            if (!dep.module) { return errc::import_fail; }
+            bind_dependency(import_desc, dep);
+        }
+        return errc::ok;
+    }
+
+    struct dependency {
+        handle module; // nullptr if it cannot be found
+        bool in_memory; // given by the resolver rather than LoadLibraryA
+    }; // struct dependency
+
+    /**
+     *  What bind_imports binds one import descriptor against. One loaded with LoadLibraryA is remembered
+     *  and freed by close(), or earlier by release_dependency.
+     *  The resolver is asked for the name as imported first. An API set contract then goes to its host straight
+     *  away, through the resolver again and LoadLibraryA, so the system loader never has to map the name.
+     */
+    template <typename ResolverT = no_import_resolver>
+    dependency load_dependency(image::import_descriptor& import_desc, ResolverT&& resolver = {}) {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        const char* dll_name = ptr_at<char>(base_addr, import_desc.Name);
+        void* inmem = resolver(dll_name);
+        if (inmem) { return {inmem, true}; }
+        auto api_sets = _api_set_map();
+        if (api_sets && reflect::api_set_map::is_contract(dll_name)) {
+            auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+            image::export_view exports(base_addr, loaded_opthdr);
+            auto host = api_sets->resolve(dll_name, exports ? exports.module_name() : nullptr);
+            if (host.size()) {
+                dll_name = host.data(); // terminated
+                inmem = resolver(dll_name);
+                if (inmem) { return {inmem, true}; }
             }
         }
+        dependency dep = {api.LoadLibraryA(dll_name), false};
+        if (dep.module) { _dependencies.push_back(dep); }
+        return dep;
+    }
+
+    // gives back what load_dependency took, for a dependency that ends up not bound
+    void release_dependency(dependency dep) {
+        WinApi& api = _impl.first();
+        if (!dep.module || dep.in_memory) { return; }
+        for (size_t i = _dependencies.size(); i-- > 0; ) {
+            if (_dependencies[i].module != dep.module) { continue; }
+            _dependencies.erase(_dependencies.begin() + i);
+            api.FreeLibrary(dep.module);
+            return;
+        }
+    }
+
+    // how the imports of one descriptor were resolved by the last bind_dependency on it
+    struct binding_stats {
+        std::string dll_name; // a copy, the image may move or go away
+        u32 name_rva; // of the name in the image, tells descriptors apart
+        size_t by_name; // looked up by name in the export table of the dependency
+        size_t hint_hits; // ... and found at their hint, without a search
+        size_t by_ordinal;
+        size_t system; // left to GetProcAddress, e.g. forwarders into modules not loaded yet
+
+        double hint_hit_rate() const { return by_name ? double(hint_hits) / double(by_name) : 0; }
+    }; // struct binding_stats
+
+    // one entry per import descriptor bound since the last map, in binding order
+    const std::vector<binding_stats>& bindings() const { return _bindings; }
+
+    /**
+     *  Fills the IAT of one import descriptor from dep.
+     *  A dependency that is a mapped image, in memory or loaded by the system, is looked up in its export table
+     *  directly, trying the hint of every import first. Others (e.g. winapi_posix stubs) go through GetProcAddress,
+     *  as do system loaded ones for whatever the export table alone cannot resolve.
+     */
+    void bind_dependency(image::import_descriptor& import_desc, dependency dep) {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        auto lookup_table = ptr_at<image::thunk_data>(base_addr, import_desc.OriginalFirstThunk);
+        auto address_table = ptr_at<image::thunk_data>(base_addr, import_desc.FirstThunk);
+        binding_stats stats = {ptr_at<char>(base_addr, import_desc.Name), import_desc.Name, 0, 0, 0, 0};
+        bool own_lookup = dep.in_memory || _is_image(dep.module);
+        for (size_t i = 0; !lookup_table[i].termination(); ++i) {
+            char* name;
+            void* proc = nullptr;
+            if (lookup_table[i].flag()) {
+                name = reinterpret_cast<char*>(lookup_table[i].ordinal());
+                if (own_lookup) { proc = reflect::get_proc_addr(dep.module, name); ++stats.by_ordinal; }
+            } else {
+                auto& by_name = ref_at<image::import_by_name>(base_addr, lookup_table[i].name_rva());
+                name = by_name.Name;
+                if (own_lookup) {
+                    bool hint_hit;
+                    proc = reflect::get_proc_addr(dep.module, name, by_name.Hint, hint_hit);
+                    ++stats.by_name;
+                    stats.hint_hits += hint_hit;
+                }
+            }
+            if (!proc && !dep.in_memory) {
+                proc = reinterpret_cast<void*>(api.GetProcAddress(dep.module, name));
+                ++stats.system;
+            }
+            address_table[i].value = reinterpret_cast<size_t>(proc);
+        }
+        // a descriptor bound again (e.g. by prelink_cache) replaces its earlier entry
+        for (auto& entry : _bindings) {
+            if (entry.name_rva == stats.name_rva) { entry = std::move(stats); return; }
+        }
+        _bindings.push_back(std::move(stats));
+    }
+
+    // on large pages there is nothing to do, see alloc_policy::large_pages
+    void protect_sections() {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        if (_large_pages) { return; }
+        auto& loaded_nthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr();
+        auto& loaded_opthdr = loaded_nthdr.OptionalHeader.local;
 
-        // set section protection
         for (auto& sechdr : loaded_nthdr.sechdrs()) {
-            if (sechdr.Characteristics & image::scn::mem_discardable) {
-                api.VirtualFree(ptr_at<void>(base_addr, sechdr.VirtualAddress), sechdr.SizeOfRawData, mem::decommit);
+            if (_discarded(sechdr)) {
+                api.VirtualFree(ptr_at<void>(base_addr, sechdr.VirtualAddress), section_size(sechdr, loaded_opthdr), mem::decommit);
             } else {
                 u32 sec_prot, sec_old_prot;
                 switch (sechdr.Characteristics & (image::scn::mem_read | image::scn::mem_write)) {
@@ -144,24 +335,49 @@ public:
                 }
                 if (sechdr.Characteristics & image::scn::mem_execute) { sec_prot <<= 4; }
                 if (sechdr.Characteristics & image::scn::mem_not_cached) { sec_prot |= page::nocache; }
-                u32 sec_size = 0;
-                if (sechdr.SizeOfRawData != 0) { sec_size = sechdr.SizeOfRawData; }
-                else if (sechdr.Characteristics & image::scn::cnt_initialized_data) { sec_size = loaded_opthdr.SizeOfInitializedData; }
-                else if (sechdr.Characteristics & image::scn::cnt_uninitialized_data) { sec_size = loaded_opthdr.SizeOfUninitializedData; }
-                if (sec_size != 0) {
-                    api.VirtualProtect(ptr_at<void>(base_addr, sechdr.VirtualAddress), sechdr.SizeOfRawData, sec_prot, &sec_old_prot);
+                // the range map_sections committed
+                u32 mapped_size = section_size(sechdr, loaded_opthdr);
+                if (mapped_size != 0) {
+                    api.VirtualProtect(ptr_at<void>(base_addr, sechdr.VirtualAddress), mapped_size, sec_prot, &sec_old_prot);
                 }
             }
         }
+    }
 
+#if defined(_WIN32) || defined(_WIN64)
+    // runs the entry point of a mapped image, close() will detach it
+    errc attach() {
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return errc::not_pe_file; }
         auto mod_entry = entry();
         if (mod_entry) {
             auto success = mod_entry(base_addr, dll::process_attach, 0);
             if (!success) { close(); return errc::attach_fail; }
         }
-
+        _attached = true;
         return errc::ok;
     }
+#endif
+
+    errc open(void* image) {
+        errc result = map(image);
+#if defined(_WIN32) || defined(_WIN64)
+        if (result == errc::ok) { result = attach(); }
+#endif
+        return result;
+    }
+
+    // frees the mapping without running the entry point or freeing dependencies, for one abandoned halfway
+    void discard() {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return; }
+        api.VirtualFree(base_addr, 0, mem::release);
+        base_addr = nullptr;
+        _attached = false;
+        _bindings.clear();
+        _dependencies.clear();
+    }
 
     void close() {
         WinApi& api = _impl.first();
@@ -171,17 +387,26 @@ public:
         auto& loaded_nthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr();
         auto& loaded_opthdr = loaded_nthdr.OptionalHeader.local;
 
-        auto mod_entry = entry();
-        if (mod_entry) { mod_entry(base_addr, dll::process_detach, 0); }
+        if (_attached) {
+            auto mod_entry = entry();
+            if (mod_entry) { mod_entry(base_addr, dll::process_detach, 0); }
+            _attached = false;
+        }
 
-        // free dependencies
-        for (auto& import_desc : image::imports_view(loaded_opthdr)) {
-            handle depmod = api.GetModuleHandleA(ptr_at<char>(base_addr, import_desc.Name));
-            if (depmod) { api.FreeLibrary(depmod); }
+        // free delay loaded dependencies, whoever bound them stored the handle in the descriptor
+        for (auto& delay_desc : image::delay_imports_view(loaded_opthdr)) {
+            if (!delay_desc.rva_based()) { continue; }
+            handle& depmod = ref_at<handle>(base_addr, delay_desc.ModuleHandleRVA);
+            if (depmod) { api.FreeLibrary(depmod); depmod = nullptr; }
         }
 
+        // free dependencies, only what load_dependency loaded: an in-memory one may share its name with a system module
+        for (size_t i = _dependencies.size(); i-- > 0; ) { api.FreeLibrary(_dependencies[i].module); }
+        _dependencies.clear();
+
         api.VirtualFree(base_addr, 0, mem::release);
         base_addr = nullptr;
+        _bindings.clear();
     }
 
     template <typename FuncT>
@@ -191,8 +416,195 @@ public:
         // GetProcAddress cannot find functions here, use handmade implementation.
         return reinterpret_cast<FuncT*>(reflect::get_proc_addr(base_addr, name));
     }
+
+    /**
+     *  Moves the loaded image to new_base (or anywhere if nullptr) without running the entry point again.
+     *  Memory cannot change address where it is, so this copies: a new range is reserved, headers and sections
+     *  are copied as they are now, on normal pages, and the relocation delta is applied to the copy.
+     *  Imports stay bound. Pointers into the image that the module stored at run time are not fixed.
+     *  For an image the caller already holds at its new place (an arena, a snapshot buffer),
+     *  image::rebase_image applies the delta alone, without copying.
+     */
+    errc relocate_to(void* new_base) {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return errc::not_pe_file; }
+        auto& old_nthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr();
+        auto& old_opthdr = old_nthdr.OptionalHeader.local;
+
+        void* moved = api.VirtualAlloc(new_base, old_opthdr.SizeOfImage, mem::reserve, page::readwrite);
+        if (!moved) { return errc::alloc_fail; }
+
+        if (!api.VirtualAlloc(moved, old_opthdr.SizeOfHeaders, mem::commit, page::readwrite)) {
+            api.VirtualFree(moved, 0, mem::release);
+            return errc::alloc_fail;
+        }
+        memcpy(moved, base_addr, old_opthdr.SizeOfHeaders);
+        // whole sections as mapped, .bss and tails past the raw data included, they may hold state by now
+        for (auto& sechdr : old_nthdr.sechdrs()) {
+            if (_discarded(sechdr)) { continue; }
+            u32 mapped_size = section_size(sechdr, old_opthdr);
+            u32 sec_old_prot;
+            auto sec_addr = ptr_at<void>(base_addr, sechdr.VirtualAddress);
+            if (!_large_pages) { api.VirtualProtect(sec_addr, mapped_size, page::readonly, &sec_old_prot); }
+            void* section = api.VirtualAlloc(ptr_at<void>(moved, sechdr.VirtualAddress), mapped_size, mem::commit, page::readwrite);
+            if (!section) {
+                api.VirtualFree(moved, 0, mem::release);
+                protect_sections(); // undo the read only copies above
+                return errc::alloc_fail;
+            }
+            memcpy(section, sec_addr, mapped_size);
+        }
+
+        auto& moved_opthdr = reinterpret_cast<image::dos_header*>(moved)->nthdr().OptionalHeader.local;
+        image::rebase_image(moved, moved_opthdr, reinterpret_cast<size_t>(moved));
+
+        api.VirtualFree(base_addr, 0, mem::release);
+        base_addr = moved;
+        _large_pages = false;
+        protect_sections();
+        return errc::ok;
+    }
+
+    /**
+     *  Emits the image in file layout through sink(const void* data, size_t size), see image::unmap_image.
+     *  Sections decommitted after loading come out as zeros.
+     */
+    template <typename SinkT>
+    size_t unmap(SinkT&& sink, bool fix_image_base = true) {
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return 0; }
+        return image::unmap_image(base_addr, sink, fix_image_base, _present_sections{this});
+    }
+
+    /**
+     *  Delay imports are left unresolved by open(), their IAT slots keep pointing at the
+     *  in-image thunks until the first call goes through the module's own delay load helper.
+     *  bind_delay_import does what that helper does for a single slot, on demand.
+     */
+    void* bind_delay_import(void* iat_slot) {
+        WinApi& api = _impl.first();
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return nullptr; }
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+
+        for (auto& delay_desc : image::delay_imports_view(loaded_opthdr)) {
+            if (!delay_desc.rva_based()) { continue; }
+            auto address_table = ptr_at<image::thunk_data>(base_addr, delay_desc.ImportAddressTableRVA);
+            auto name_table = ptr_at<image::thunk_data>(base_addr, delay_desc.ImportNameTableRVA);
+            size_t i = 0;
+            for (; !name_table[i].termination() && &address_table[i] != iat_slot; ++i) {}
+            if (name_table[i].termination()) { continue; }
+
+            handle& depmod = ref_at<handle>(base_addr, delay_desc.ModuleHandleRVA);
+            if (!depmod) { depmod = api.LoadLibraryA(ptr_at<char>(base_addr, delay_desc.DllNameRVA)); }
+            if (!depmod) { return nullptr; }
+            char* name = name_table[i].flag()
+                ? reinterpret_cast<char*>(name_table[i].ordinal())
+                : ref_at<image::import_by_name>(base_addr, name_table[i].name_rva()).Name;
+            auto proc = reinterpret_cast<void*>(api.GetProcAddress(depmod, name));
+            if (proc) { address_table[i].value = reinterpret_cast<size_t>(proc); }
+            return proc;
+        }
+        return nullptr;
+    }
+
+    // binds every delay import of one dependency, returns false if any of them cannot be found
+    bool bind_delay_imports(const char* dll_name) {
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return false; }
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+
+        for (auto& delay_desc : image::delay_imports_view(loaded_opthdr)) {
+            if (!delay_desc.rva_based()) { continue; }
+            if (!reflect::dll_name_cmp<char, char>(ptr_at<char>(base_addr, delay_desc.DllNameRVA), dll_name)) { continue; }
+            auto address_table = ptr_at<image::thunk_data>(base_addr, delay_desc.ImportAddressTableRVA);
+            auto name_table = ptr_at<image::thunk_data>(base_addr, delay_desc.ImportNameTableRVA);
+            bool all_found = true;
+            for (size_t i = 0; !name_table[i].termination(); ++i) {
+                if (_delay_slot_bound(address_table[i])) { continue; }
+                all_found = bind_delay_import(&address_table[i]) && all_found;
+            }
+            return all_found;
+        }
+        return false;
+    }
+
+    struct delay_import_stats {
+        size_t modules; // delay loaded dependencies declared
+        size_t modules_loaded; // ... of which have been loaded
+        size_t imports; // delay imported functions declared
+        size_t imports_resolved; // ... of which have been bound
+    }; // struct delay_import_stats
+
+    /**
+     *  Counts are read from the image itself, so bindings done by the module's own
+     *  delay load helper are included: a bound slot no longer points into the image.
+     */
+    delay_import_stats delay_imports() {
+        delay_import_stats stats = {0, 0, 0, 0};
+        void*& base_addr = _impl.second();
+        if (!base_addr) { return stats; }
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+
+        for (auto& delay_desc : image::delay_imports_view(loaded_opthdr)) {
+            if (!delay_desc.rva_based()) { continue; }
+            ++stats.modules;
+            if (ref_at<handle>(base_addr, delay_desc.ModuleHandleRVA)) { ++stats.modules_loaded; }
+            auto address_table = ptr_at<image::thunk_data>(base_addr, delay_desc.ImportAddressTableRVA);
+            auto name_table = ptr_at<image::thunk_data>(base_addr, delay_desc.ImportNameTableRVA);
+            for (size_t i = 0; !name_table[i].termination(); ++i) {
+                ++stats.imports;
+                if (_delay_slot_bound(address_table[i])) { ++stats.imports_resolved; }
+            }
+        }
+        return stats;
+    }
+
+private:
+    std::vector<binding_stats> _bindings;
+    std::vector<dependency> _dependencies; // loaded with LoadLibraryA, for close() to free
+
+    const reflect::api_set_map* _api_set_map() const {
+        if (_api_sets) { return _api_sets; }
+#if defined(_WIN32) || defined(_WIN64)
+        return &reflect::current_api_set_map();
+#else
+        return nullptr;
+#endif
+    }
+
+    // whether a dependency handle is the base of a mapped image, which stub modules are not
+    static bool _is_image(handle module) {
+        if (!module) { return false; }
+        auto& doshdr = *reinterpret_cast<image::dos_header*>(module);
+        return doshdr.e_magic == image::dos_signature && doshdr.nthdr().Signature == image::nt_signature;
+    }
+
+    struct _present_sections {
+        memory_module* self;
+        bool operator()(image::section_header& sechdr) const { return !self->_discarded(sechdr); }
+    };
+
+    // .reloc is discardable, but it is kept committed so that the image can be moved later
+    bool _discarded(image::section_header& sechdr) {
+        void*& base_addr = _impl.second();
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+        if (!(sechdr.Characteristics & image::scn::mem_discardable)) { return false; }
+        auto& reloc_pos = loaded_opthdr.datadir(image::directory_entry::basereloc);
+        return !(reloc_pos.Size && reloc_pos.VirtualAddress - sechdr.VirtualAddress < sechdr.SizeOfRawData);
+    }
+
+    bool _delay_slot_bound(image::thunk_data slot) {
+        void*& base_addr = _impl.second();
+        auto& loaded_opthdr = reinterpret_cast<image::dos_header*>(base_addr)->nthdr().OptionalHeader.local;
+        size_t offset = size_t(slot.value) - reinterpret_cast<size_t>(base_addr);
+        return offset >= loaded_opthdr.SizeOfImage;
+    }
 }; // class memory_module
 
 } // namespace loader
 } // namespace runtime
 } // namespace pe
+
+#endif // __PETRICKS_RT_LOADER__
@@ -4,10 +4,6 @@
 
 #include "./rt-basics.hpp"
 
-#if !defined(_WIN32) && !defined(_WIN64)
-#error This file needs win32/win64 environment!
-#endif
-
 namespace pe {
 namespace runtime {
 
@@ -76,7 +72,8 @@ struct peb {
     void *Reserved7;
     u32 Reserved8;
     u32 AtlThunkSListPtr32;
-    void *Reserved9[45];
+    void *ApiSetMap; // the API set schema, see apiset.hpp
+    void *Reserved9[44];
     u8 Reserved10[96];
     void *PostProcessInitRoutine;
     u8 Reserved11[128];
@@ -0,0 +1,241 @@
+#pragma once
+#ifndef __PETRICKS_RT_POSIX__
+#define __PETRICKS_RT_POSIX__
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "./rt-basics.hpp"
+
+/**
+ *  A winapi provider on top of mmap/mprotect/madvise, so that memory_module maps, relocates and protects
+ *  images on POSIX systems as well. Entry points are never run there.
+ *  Reservations are tracked process-wide with one protection value per page, which is what VirtualQuery
+ *  and the old protection reported by VirtualProtect need.
+ *  Imports resolve to stubs: every library "loads" as the same pseudo handle and every procedure is
+ *  unresolved_import. Derive from winapi_posix and hide the library functions to resolve them for real.
+ */
+
+namespace pe {
+namespace runtime {
+
+namespace posix {
+
+static inline size_t page_size() {
+    static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+static inline int page_protection(u32 protect) {
+    switch (protect & 0xFF) {
+        case page::readonly: return PROT_READ;
+        case page::readwrite: case page::writecopy: return PROT_READ | PROT_WRITE;
+        case page::execute: return PROT_EXEC;
+        case page::execute_read: return PROT_READ | PROT_EXEC;
+        case page::execute_readwrite: case page::execute_writecopy: return PROT_READ | PROT_WRITE | PROT_EXEC;
+        default: return PROT_NONE;
+    }
+}
+
+struct region {
+    u32 alloc_protect;
+    std::vector<u32> protect; // per page, 0 while reserved but not committed
+}; // struct region
+
+struct region_table {
+    std::mutex lock;
+    std::map<size_t, region> regions; // keyed by reservation base
+
+    // the reservation containing addr, or end()
+    std::map<size_t, region>::iterator find(const void* addr) {
+        size_t pos = reinterpret_cast<size_t>(addr);
+        auto it = regions.upper_bound(pos);
+        if (it == regions.begin()) { return regions.end(); }
+        --it;
+        return pos - it->first < it->second.protect.size() * page_size() ? it : regions.end();
+    }
+}; // struct region_table
+
+// magic statics
+inline region_table& __regions() {
+    static region_table table;
+    return table;
+}
+
+static inline size_t PETRICKS_STDCALL unresolved_import() { return 0; }
+
+} // namespace posix
+
+struct winapi_posix {
+private:
+    static void* _large_alloc(size_t size, u32 protect) {
+#ifdef MADV_HUGEPAGE
+        const size_t large = GetLargePageMinimum();
+        size = (size + large - 1) & ~(large - 1);
+        // over-reserve to be able to cut an aligned range out of it
+        void* addr = mmap(nullptr, size + large, posix::page_protection(protect), MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr == MAP_FAILED) { return nullptr; }
+        size_t first = (reinterpret_cast<size_t>(addr) + large - 1) & ~(large - 1);
+        if (first != reinterpret_cast<size_t>(addr)) { munmap(addr, first - reinterpret_cast<size_t>(addr)); }
+        munmap(reinterpret_cast<void*>(first + size), reinterpret_cast<size_t>(addr) + large - first);
+        if (madvise(reinterpret_cast<void*>(first), size, MADV_HUGEPAGE) != 0) { munmap(reinterpret_cast<void*>(first), size); return nullptr; }
+        auto& table = posix::__regions();
+        std::lock_guard<std::mutex> guard(table.lock);
+        auto& reserved = table.regions[first];
+        reserved.alloc_protect = protect;
+        reserved.protect.assign(size / posix::page_size(), protect);
+        return reinterpret_cast<void*>(first);
+#else
+        (void)size; (void)protect;
+        return nullptr;
+#endif
+    }
+
+public:
+    // zeroed, so whoever checks for headers there finds none
+    static handle pseudo_module() {
+        static image::dos_header module;
+        return &module;
+    }
+
+    static winproc GetProcAddress(handle, const char*) { return &posix::unresolved_import; }
+    static handle GetModuleHandleA(const char*) { return pseudo_module(); }
+    static handle GetModuleHandleW(const wchar_t*) { return pseudo_module(); }
+    static handle LoadLibraryA(const char*) { return pseudo_module(); }
+    static handle LoadLibraryW(const wchar_t*) { return pseudo_module(); }
+    static winbool FreeLibrary(handle) { return 1; }
+
+    // the transparent huge page size of x86-64 and arm64 with 4K pages, 0 where there are none
+    static size_t GetLargePageMinimum() {
+#ifdef MADV_HUGEPAGE
+        return 0x200000;
+#else
+        return 0;
+#endif
+    }
+
+    static void* VirtualAlloc(void* lpAddress, size_t dwSize, u32 flAllocationType, u32 flProtect) {
+        if (dwSize == 0) { return nullptr; }
+        size_t ps = posix::page_size();
+        size_t first = reinterpret_cast<size_t>(lpAddress) & ~(ps - 1);
+        size_t last = (reinterpret_cast<size_t>(lpAddress) + dwSize + ps - 1) & ~(ps - 1);
+        auto& table = posix::__regions();
+
+        if (flAllocationType & mem::large_pages) {
+            // transparent huge pages: anywhere, reserved and committed at once, as Windows requires
+            if (lpAddress || (flAllocationType & (mem::reserve | mem::commit)) != (mem::reserve | mem::commit)) { return nullptr; }
+            return _large_alloc(dwSize, flProtect);
+        }
+
+        if (flAllocationType & mem::reserve) {
+            bool commit = (flAllocationType & mem::commit) != 0;
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_FIXED_NOREPLACE
+            if (first) { flags |= MAP_FIXED_NOREPLACE; }
+#endif
+            void* addr = mmap(reinterpret_cast<void*>(first), last - first, commit ? posix::page_protection(flProtect) : PROT_NONE, flags, -1, 0);
+            if (addr == MAP_FAILED) { return nullptr; }
+            // like VirtualAlloc, fail rather than reserve somewhere else
+            if (first && reinterpret_cast<size_t>(addr) != first) { munmap(addr, last - first); return nullptr; }
+            std::lock_guard<std::mutex> guard(table.lock);
+            auto& reserved = table.regions[reinterpret_cast<size_t>(addr)];
+            reserved.alloc_protect = flProtect;
+            reserved.protect.assign((last - first) / ps, commit ? flProtect : 0);
+            return addr;
+        }
+
+        if (flAllocationType & mem::commit) {
+            std::lock_guard<std::mutex> guard(table.lock);
+            auto it = table.find(lpAddress);
+            if (it == table.regions.end() || last - it->first > it->second.protect.size() * ps) { return nullptr; }
+            if (mprotect(reinterpret_cast<void*>(first), last - first, posix::page_protection(flProtect)) != 0) { return nullptr; }
+            for (size_t i = (first - it->first) / ps; i < (last - it->first) / ps; ++i) { it->second.protect[i] = flProtect; }
+            return reinterpret_cast<void*>(first);
+        }
+        return nullptr;
+    }
+
+    static winbool VirtualFree(void* lpAddress, size_t dwSize, u32 dwFreeType) {
+        size_t ps = posix::page_size();
+        auto& table = posix::__regions();
+        std::lock_guard<std::mutex> guard(table.lock);
+        auto it = table.find(lpAddress);
+        if (it == table.regions.end()) { return 0; }
+        size_t region_size = it->second.protect.size() * ps;
+
+        if (dwFreeType & mem::release) {
+            if (dwSize != 0 || reinterpret_cast<size_t>(lpAddress) != it->first) { return 0; }
+            munmap(lpAddress, region_size);
+            table.regions.erase(it);
+            return 1;
+        }
+
+        if (dwFreeType & mem::decommit) {
+            size_t first = reinterpret_cast<size_t>(lpAddress) & ~(ps - 1);
+            size_t last = dwSize == 0 ? it->first + region_size : (reinterpret_cast<size_t>(lpAddress) + dwSize + ps - 1) & ~(ps - 1);
+            if (last - it->first > region_size) { return 0; }
+            // drop the pages so that committing them again gives zeros, as on Windows
+            madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+            mprotect(reinterpret_cast<void*>(first), last - first, PROT_NONE);
+            for (size_t i = (first - it->first) / ps; i < (last - it->first) / ps; ++i) { it->second.protect[i] = 0; }
+            return 1;
+        }
+        return 0;
+    }
+
+    static size_t VirtualQuery(const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength) {
+        if (dwLength < sizeof(memory_basic_information)) { return 0; }
+        size_t ps = posix::page_size();
+        size_t pos = reinterpret_cast<size_t>(lpAddress) & ~(ps - 1);
+        auto& table = posix::__regions();
+        std::lock_guard<std::mutex> guard(table.lock);
+        *lpBuffer = memory_basic_information();
+        lpBuffer->BaseAddress = reinterpret_cast<void*>(pos);
+
+        auto it = table.find(lpAddress);
+        if (it == table.regions.end()) {
+            // free up to the next reservation we know of
+            auto next = table.regions.upper_bound(pos);
+            lpBuffer->RegionSize = next == table.regions.end() ? ps : next->first - pos;
+            lpBuffer->State = mem::free;
+            lpBuffer->Protect = page::noaccess;
+            return sizeof(memory_basic_information);
+        }
+
+        auto& pages = it->second.protect;
+        size_t first = (pos - it->first) / ps, last = first;
+        while (last < pages.size() && pages[last] == pages[first]) { ++last; }
+        lpBuffer->AllocationBase = reinterpret_cast<void*>(it->first);
+        lpBuffer->AllocationProtect = it->second.alloc_protect;
+        lpBuffer->RegionSize = (last - first) * ps;
+        lpBuffer->State = pages[first] ? mem::commit : mem::reserve;
+        lpBuffer->Protect = pages[first];
+        lpBuffer->Type = mem::private_;
+        return sizeof(memory_basic_information);
+    }
+
+    static winbool VirtualProtect(void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect) {
+        size_t ps = posix::page_size();
+        size_t first = reinterpret_cast<size_t>(lpAddress) & ~(ps - 1);
+        size_t last = (reinterpret_cast<size_t>(lpAddress) + dwSize + ps - 1) & ~(ps - 1);
+        auto& table = posix::__regions();
+        std::lock_guard<std::mutex> guard(table.lock);
+        auto it = table.find(lpAddress);
+        if (it == table.regions.end() || last - it->first > it->second.protect.size() * ps) { return 0; }
+        // every page must be committed
+        for (size_t i = (first - it->first) / ps; i < (last - it->first) / ps; ++i) {
+            if (!it->second.protect[i]) { return 0; }
+        }
+        if (mprotect(reinterpret_cast<void*>(first), last - first, posix::page_protection(flNewProtect)) != 0) { return 0; }
+        if (lpflOldProtect) { *lpflOldProtect = it->second.protect[(first - it->first) / ps]; }
+        for (size_t i = (first - it->first) / ps; i < (last - it->first) / ps; ++i) { it->second.protect[i] = flNewProtect; }
+        return 1;
+    }
+}; // struct winapi_posix
+
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_RT_POSIX__
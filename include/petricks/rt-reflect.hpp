@@ -2,13 +2,13 @@
 #ifndef __PETRICKS_RT_REFLECT__
 #define __PETRICKS_RT_REFLECT__
 
-#include <intrin.h>
 #include <tuple>
 #include <algorithm>
+#include "./apiset.hpp"
 #include "./rt-pebteb.hpp"
 
-#if !defined(_WIN32) && !defined(_WIN64)
-#error This file needs win32/win64 environment!
+#if defined(_WIN32) || defined(_WIN64)
+#include <intrin.h>
 #endif
 
 namespace pe {
@@ -17,12 +17,87 @@ namespace reflect {
 
 template <typename CharT1, typename CharT2>
 bool dll_name_cmp(basic_string_view<CharT1> s1, basic_string_view<CharT2> s2) {
+    stats::add(stats::counter::name_compares);
     string_view suffix(".dll");
     if (windows_style_cmp<CharT1, char>(s1.substr(s1.size() - suffix.size()), suffix)) { s1 = s1.substr(0, s1.size() - suffix.size()); }
     if (windows_style_cmp<CharT2, char>(s2.substr(s2.size() - suffix.size()), suffix)) { s2 = s2.substr(0, s2.size() - suffix.size()); }
     return windows_style_cmp<CharT1, CharT2>(s1, s2);
 }
 
+/**
+ *  Besides the three ordered lists, the loader keeps every module in one of 32 hash buckets, linked through
+ *  HashLinks. The bucket is picked by the x65599 hash of the upcased base name (LdrpHashUnicodeString).
+ *  Only ASCII names are upcased here, like everywhere else in this file.
+ */
+constexpr size_t ldr_hash_buckets = 32;
+
+template <typename CharT>
+static inline u32 ldr_hash_name(basic_string_view<CharT> name, u32 hash = 0) {
+    for (size_t i = 0; i < name.size(); ++i) {
+        u32 ch = u32(name[i]);
+        if (ch >= 'a' && ch <= 'z') { ch -= 'a' - 'A'; }
+        hash = hash * 65599 + ch;
+    }
+    return hash;
+}
+
+// the bucket a lookup by name goes to, names without an extension mean .dll as for LoadLibrary
+template <typename CharT>
+static inline u32 ldr_hash_bucket(basic_string_view<CharT> name) {
+    u32 hash = ldr_hash_name(name);
+    if (std::find(name.begin(), name.end(), CharT('.')) == name.end()) { hash = ldr_hash_name(string_view(".dll"), hash); }
+    return hash & (ldr_hash_buckets - 1);
+}
+
+template <typename CharT>
+static inline ldr_data_table_entry* find_module_in_bucket(list_entry* bucket, basic_string_view<CharT> name) {
+    for (auto& mod : list_view<ldr_data_table_entry, &ldr_data_table_entry::HashLinks>(bucket)) {
+        stats::add(stats::counter::ldr_entries);
+        if (dll_name_cmp<wchar_t, CharT>(mod.BaseDllName, name)) { return &mod; }
+    }
+    return nullptr;
+}
+
+// whether the HashLinks ring of entry passes through bucket, only list links are read
+static inline bool ldr_bucket_holds(list_entry* bucket, ldr_data_table_entry& entry) {
+    for (list_entry* link = entry.HashLinks.Flink; link && link != &entry.HashLinks; link = link->Flink) {
+        if (link == bucket) { return true; }
+    }
+    return false;
+}
+
+/**
+ *  The bucket heads are an array inside ntdll that nothing exports. Every HashLinks ring passes through
+ *  one of them, so walking the ring of the first module in load_order finds the one link inside the image
+ *  of table_owner, and the bucket of that module's name tells where the array starts.
+ *  The next few modules must then sit in the buckets their names hash to. Loaders that bucket otherwise
+ *  (up to Windows 7 by the first letter of the name) fail that check and have no table.
+ */
+static inline list_entry* find_ldr_hash_table(list_entry* load_order, ldr_data_table_entry& table_owner) {
+    ldr_list_view<&ldr_data_table_entry::InLoadOrderLinks> modules(load_order);
+    if (modules.begin() == modules.end()) { return nullptr; }
+    auto& first = *modules.begin();
+    size_t owner_base = reinterpret_cast<size_t>(table_owner.DllBase);
+    list_entry* table = nullptr;
+    for (list_entry* link = first.HashLinks.Flink; link && link != &first.HashLinks; link = link->Flink) {
+        if (reinterpret_cast<size_t>(link) - owner_base < table_owner.SizeOfImage) {
+            table = link - ldr_hash_bucket(wstring_view(first.BaseDllName));
+            break;
+        }
+    }
+    if (!table) { return nullptr; }
+
+    size_t checked = 0;
+    for (auto& mod : modules) {
+        if (!mod.DllBase || checked++ == 8) { break; }
+        if (!ldr_bucket_holds(&table[ldr_hash_bucket(wstring_view(mod.BaseDllName))], mod)) { return nullptr; }
+    }
+    return table;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+// the loader data of the running process, which only exists on Windows
+
 static inline teb* get_current_teb() {
     return reinterpret_cast<teb*>(
 #ifdef _WIN64
@@ -39,65 +114,121 @@ static inline ldr_data_table_entry* find_module(PredT pred) {
     auto ldr = get_current_teb()->ProcessEnvironmentBlock->Ldr;
     for (auto& mod : ldr->modules(ldr_order::load)) {
         if (!mod.DllBase) { break; }
+        stats::add(stats::counter::ldr_entries);
         if (pred(mod)) { return &mod; }
     }
     return nullptr;
 }
 
+// located once, the bucket array lives in ntdll for the lifetime of the process
+static inline list_entry* get_ldr_hash_table() {
+    static list_entry* table = []() -> list_entry* {
+        auto ldr = get_current_teb()->ProcessEnvironmentBlock->Ldr;
+        auto ntdll = find_module([](ldr_data_table_entry& mod) { return dll_name_cmp<wchar_t, char>(mod.BaseDllName, "ntdll.dll"); });
+        if (!ntdll) { return nullptr; }
+        return find_ldr_hash_table(&ldr->InLoadOrderModuleList, *ntdll);
+    }();
+    return table;
+}
+
+/**
+ *  Looks up a loaded module by base name through the loader's hash buckets. Without a table, or when the bucket
+ *  misses (e.g. a name the loader folded beyond ASCII, or loaded without an extension), the load order list is walked.
+ */
+template <typename CharT>
+static inline ldr_data_table_entry* find_module_by_name(basic_string_view<CharT> name) {
+    list_entry* table = get_ldr_hash_table();
+    if (table) {
+        auto mod = find_module_in_bucket(&table[ldr_hash_bucket(name)], name);
+        if (mod) { return mod; }
+    }
+    return find_module([&](ldr_data_table_entry& mod) { return dll_name_cmp<wchar_t, CharT>(mod.BaseDllName, name); });
+}
+
 template <typename CharT>
 static inline void* get_module_base(basic_string_view<CharT> name) {
-    auto mod = find_module([&](ldr_data_table_entry& mod) { return dll_name_cmp<wchar_t, CharT>(mod.BaseDllName, name); });
+    auto mod = find_module_by_name(name);
     return mod == nullptr ? nullptr : mod->DllBase;
 }
 
+// the API set schema of the process, parsed once on first use
+static inline const api_set_map& current_api_set_map() {
+    static api_set_map map = []() {
+        api_set_map parsed;
+        auto schema = static_cast<const u32*>(get_current_teb()->ProcessEnvironmentBlock->ApiSetMap);
+        if (!schema) { return parsed; }
+        // from version 4 on the schema records its size, version 2 is trusted to stay within its offsets
+        parsed.parse(schema, schema[0] >= 4 ? schema[1] : u32(-1));
+        return parsed;
+    }();
+    return map;
+}
+
+#endif // _WIN32
+
 static inline std::pair<bool, u32> find_module_export(void* mod_base, const char* name) {
     auto& opthdr = reinterpret_cast<image::dos_header*>(mod_base)->nthdr().OptionalHeader.local;
-    auto& export_pos = opthdr.datadir(image::directory_entry::export_);
-    if (export_pos.Size == 0) { return {false, 0}; }
-    auto& export_dir = ref_at<image::export_directory>(mod_base, export_pos.VirtualAddress);
-
-    u16 proc_idx;
-    if (reinterpret_cast<size_t>(name) >> 16) { // by name
-        auto export_name_addrs = ptr_at<u32>(mod_base, export_dir.AddressOfNames);
-        auto export_name_ordinals = ptr_at<u16>(mod_base, export_dir.AddressOfNameOrdinals);
-        // https://learn.microsoft.com/en-us/windows/win32/debug/pe-format#export-name-pointer-table
-        // Export name table is lexically ordered to allow binary searches.
-        auto name_pos = std::lower_bound(export_name_addrs, export_name_addrs + export_dir.NumberOfNames, name,
-            [&](const u32& export_name_addr, const char* name) {
-                // strcmp here is from intrin.h
-                return strcmp(ptr_at<char>(mod_base, export_name_addr), name) < 0;
-            }
-        );
-        if (strcmp(ptr_at<char>(mod_base, *name_pos), name) != 0) { return {false, 0}; }
-        proc_idx = export_name_ordinals[name_pos - export_name_addrs];
-    } else { // by ordinal
-        u16 ordinal = reinterpret_cast<size_t>(name) & 0xFFFF;
-        proc_idx = ordinal - export_dir.Base;
-    }
-    
-    auto export_proc_addrs = ptr_at<u32>(mod_base, export_dir.AddressOfFunctions);
-    auto export_rva = export_proc_addrs[proc_idx];
-    auto is_forward = export_rva >= export_pos.VirtualAddress && export_rva < export_pos.VirtualAddress + export_pos.Size;
-    return {is_forward, export_rva};
+    image::export_view exports(mod_base, opthdr);
+    if (!exports) { return {false, 0}; }
+    auto export_rva = (reinterpret_cast<size_t>(name) >> 16)
+        ? exports.rva_of(name) // by name
+        : exports.rva_of(u16(reinterpret_cast<size_t>(name) & 0xFFFF)); // by ordinal
+    return {exports.is_forwarder(export_rva), export_rva};
 }
 
-static inline void* get_proc_addr(void* mod_base, const char* name) {
-    auto export_pos = find_module_export(mod_base, name);
+static inline void* get_proc_addr(void* mod_base, const char* name);
+
+namespace detail {
+
+// the address of an export found at export_pos in mod_base, forwarders followed
+static inline void* export_address(void* mod_base, std::pair<bool, u32> export_pos) {
     if (!export_pos.first) { return export_pos.second == 0 ? nullptr : ptr_at<void>(mod_base, export_pos.second); }
     // this is a forwarder, find recursively
+    stats::add(stats::counter::forwarder_hops);
     auto forwarder_string = ptr_at<char>(mod_base, export_pos.second);
     for (size_t dot_pos = 0; forwarder_string[dot_pos] != 0; ++dot_pos) {
         if (forwarder_string[dot_pos] == '.') {
-            auto forward_mod_base = get_module_base(string_view(forwarder_string, dot_pos));
+#if defined(_WIN32) || defined(_WIN64)
+            string_view forward_dll(forwarder_string, dot_pos);
+            // contracts are never in the loader lists, go to their host instead
+            if (api_set_map::is_contract(forward_dll)) {
+                auto& opthdr = reinterpret_cast<image::dos_header*>(mod_base)->nthdr().OptionalHeader.local;
+                image::export_view exports(mod_base, opthdr);
+                auto host = current_api_set_map().resolve(forward_dll, string_view(exports.module_name()));
+                if (host.size()) { forward_dll = host; }
+            }
+            auto forward_mod_base = get_module_base(forward_dll);
             if (forward_mod_base == nullptr) { return nullptr; }
             auto forward_name = forwarder_string + dot_pos + 1;
             if (forward_name[0] == '#') { forward_name = reinterpret_cast<char*>(number_from_string(forward_name + 1)); }
             return get_proc_addr(forward_mod_base, forward_name);
+#else
+            return nullptr; // no loaded modules to forward to
+#endif
         }
     }
     return nullptr;
 }
 
+} // namespace detail
+
+static inline void* get_proc_addr(void* mod_base, const char* name) {
+    return detail::export_address(mod_base, find_module_export(mod_base, name));
+}
+
+/**
+ *  get_proc_addr by name with the hint of an import_by_name: the name at index hint of the export name table
+ *  is compared first and the table only searched if it differs. hint_hit tells which happened.
+ */
+static inline void* get_proc_addr(void* mod_base, const char* name, u16 hint, bool& hint_hit) {
+    auto& opthdr = reinterpret_cast<image::dos_header*>(mod_base)->nthdr().OptionalHeader.local;
+    image::export_view exports(mod_base, opthdr);
+    hint_hit = false;
+    if (!exports) { return nullptr; }
+    auto export_rva = exports.rva_of(name, hint, hint_hit);
+    return detail::export_address(mod_base, {exports.is_forwarder(export_rva), export_rva});
+}
+
 } // namespace reflect
 } // namespace runtime
 } // namespace pe
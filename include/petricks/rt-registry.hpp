@@ -0,0 +1,303 @@
+#pragma once
+#ifndef __PETRICKS_RT_REGISTRY__
+#define __PETRICKS_RT_REGISTRY__
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "./hash.hpp"
+#include "./rt-loader.hpp"
+
+/**
+ *  Shares in-memory modules between threads: each image identity (a content hash, a name ...) is opened once
+ *  and handed out as reference counted module_refs.
+ *
+ *  Lookups never lock: the slot table is published through an atomic pointer and probed with plain loads,
+ *  taking a reference is one fetch_add. Opening, growing and purging serialize on a mutex, and a module that
+ *  is being opened is waited for instead of opened twice.
+ *  Readers may still hold a table or an entry that a writer replaced, so both are retired rather than freed:
+ *  lock-free readers register under the current epoch, and a writer advances the epoch once nobody is left
+ *  under the previous one. What was retired at epoch e is freed from epoch e + 2 on, an entry only once its
+ *  last module_ref is gone too. Reclamation happens on the writer paths, opening and purging.
+ */
+
+namespace pe {
+namespace runtime {
+namespace loader {
+
+template <typename WinApi = winapi_default>
+class module_registry {
+public:
+    using module_type = memory_module<WinApi>;
+    using errc = typename module_type::errc;
+
+private:
+    enum : int { _opening, _ready, _failed };
+    // refs of a purged entry, late fetch_adds from readers keep it negative
+    static constexpr long _dead = LONG_MIN / 2;
+
+    struct _entry {
+        u64 key;
+        std::atomic<long> refs;
+        std::atomic<int> state;
+        errc result;
+        module_type module;
+        _entry(u64 key_, const WinApi& api) : key(key_), refs(1), state(_opening), result(errc::ok), module(api) {}
+    }; // struct _entry
+
+    struct _table {
+        size_t mask;
+        std::unique_ptr<std::atomic<_entry*>[]> slots;
+        _table(size_t capacity) : mask(capacity - 1), slots(new std::atomic<_entry*>[capacity]()) {}
+    }; // struct _table
+
+    template <typename T>
+    struct _retired {
+        size_t epoch;
+        std::unique_ptr<T> ptr;
+    }; // struct _retired
+
+    WinApi _api;
+    std::atomic<_table*> _current;
+    std::atomic<size_t> _epoch;
+    std::atomic<size_t> _readers[2]; // lock-free readers by parity of the epoch they entered under
+    std::vector<_retired<_table>> _retired_tables;
+    std::vector<_retired<_entry>> _retired_entries; // erased from the table, failed or purged
+    size_t _used = 0; // live entries and tombstones in the current table
+    size_t _live = 0;
+    std::mutex _lock;
+    std::condition_variable _opened;
+    char _tombstone_tag;
+
+    _entry* _tombstone() { return reinterpret_cast<_entry*>(&_tombstone_tag); }
+
+    // keeps whatever _find returns alive until destroyed
+    class _read_guard {
+        std::atomic<size_t>* _count;
+    public:
+        explicit _read_guard(module_registry& self) {
+            for (;;) {
+                size_t epoch = self._epoch.load();
+                _count = &self._readers[epoch & 1];
+                _count->fetch_add(1);
+                // a writer that moved on in between did not see this reader, try again under the new epoch
+                if (self._epoch.load() == epoch) { return; }
+                _count->fetch_sub(1);
+            }
+        }
+        ~_read_guard() { _count->fetch_sub(1, std::memory_order_release); }
+        _read_guard(const _read_guard&) = delete;
+        _read_guard& operator=(const _read_guard&) = delete;
+    }; // class _read_guard
+
+    // wait-free, may miss an entry inserted concurrently
+    _entry* _find(u64 key) {
+        _table* table = _current.load(std::memory_order_acquire);
+        for (size_t i = 0, pos = key & table->mask; i <= table->mask; ++i, pos = (pos + 1) & table->mask) {
+            _entry* entry = table->slots[pos].load(std::memory_order_acquire);
+            if (!entry) { return nullptr; }
+            if (entry != _tombstone() && entry->key == key) { return entry; }
+        }
+        return nullptr;
+    }
+
+    static bool _try_ref(_entry* entry) {
+        return entry->refs.fetch_add(1, std::memory_order_acq_rel) >= 0;
+    }
+
+    void _release(_entry* entry) {
+        entry->refs.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    // callers hold _lock
+    void _grow() {
+        _table* table = _current.load(std::memory_order_relaxed);
+        size_t capacity = table->mask + 1;
+        if ((_used + 1) * 4 <= capacity * 3) { return; }
+        while ((_live + 1) * 2 > capacity) { capacity *= 2; }
+        std::unique_ptr<_table> grown(new _table(capacity));
+        for (size_t i = 0; i <= table->mask; ++i) {
+            _entry* entry = table->slots[i].load(std::memory_order_relaxed);
+            if (!entry || entry == _tombstone()) { continue; }
+            size_t pos = entry->key & grown->mask;
+            while (grown->slots[pos].load(std::memory_order_relaxed)) { pos = (pos + 1) & grown->mask; }
+            grown->slots[pos].store(entry, std::memory_order_relaxed);
+        }
+        _used = _live;
+        _current.store(grown.release(), std::memory_order_release);
+        _retired_tables.push_back({_epoch.load(std::memory_order_relaxed), std::unique_ptr<_table>(table)});
+    }
+
+    _entry* _insert(u64 key) {
+        _reclaim();
+        _grow();
+        _table* table = _current.load(std::memory_order_relaxed);
+        _entry* entry = new _entry(key, _api);
+        size_t pos = key & table->mask;
+        for (;; pos = (pos + 1) & table->mask) {
+            _entry* slot = table->slots[pos].load(std::memory_order_relaxed);
+            if (!slot) { ++_used; break; }
+            if (slot == _tombstone()) { break; }
+        }
+        table->slots[pos].store(entry, std::memory_order_release);
+        ++_live;
+        return entry;
+    }
+
+    void _erase(_entry* entry) {
+        _table* table = _current.load(std::memory_order_relaxed);
+        for (size_t pos = entry->key & table->mask; ; pos = (pos + 1) & table->mask) {
+            _entry* slot = table->slots[pos].load(std::memory_order_relaxed);
+            if (!slot) { return; }
+            if (slot == entry) {
+                table->slots[pos].store(_tombstone(), std::memory_order_release);
+                --_live;
+                _retired_entries.push_back({_epoch.load(std::memory_order_relaxed), std::unique_ptr<_entry>(entry)});
+                return;
+            }
+        }
+    }
+
+    // callers hold _lock, frees what no reader can reach any more
+    void _reclaim() {
+        size_t epoch = _epoch.load(std::memory_order_relaxed);
+        if (_readers[(epoch + 1) & 1].load() == 0) { _epoch.store(++epoch); }
+        _retired_tables.erase(std::remove_if(_retired_tables.begin(), _retired_tables.end(),
+            [&](const _retired<_table>& table) { return table.epoch + 2 <= epoch; }
+        ), _retired_tables.end());
+        _retired_entries.erase(std::remove_if(_retired_entries.begin(), _retired_entries.end(),
+            [&](const _retired<_entry>& entry) {
+                if (entry.epoch + 2 > epoch) { return false; }
+                // purged entries are dead already, failed ones die once their waiters let go
+                long idle = 0;
+                return entry.ptr->refs.load(std::memory_order_acquire) < 0
+                    || entry.ptr->refs.compare_exchange_strong(idle, _dead, std::memory_order_acq_rel);
+            }
+        ), _retired_entries.end());
+    }
+
+public:
+    class module_ref {
+        friend class module_registry;
+        _entry* _ptr = nullptr;
+        module_ref(_entry* ptr) : _ptr(ptr) {}
+    public:
+        module_ref() {}
+        module_ref(const module_ref& other) : _ptr(other._ptr) { if (_ptr) { _ptr->refs.fetch_add(1, std::memory_order_relaxed); } }
+        module_ref(module_ref&& other) : _ptr(other._ptr) { other._ptr = nullptr; }
+        module_ref& operator=(module_ref other) { std::swap(_ptr, other._ptr); return *this; }
+        ~module_ref() { reset(); }
+
+        void reset() {
+            if (_ptr) { _ptr->refs.fetch_sub(1, std::memory_order_acq_rel); _ptr = nullptr; }
+        }
+        explicit operator bool() const { return _ptr != nullptr; }
+        module_type& operator*() const { return _ptr->module; }
+        module_type* operator->() const { return &_ptr->module; }
+        u64 key() const { return _ptr->key; }
+    }; // class module_ref
+
+    module_registry(const WinApi& api = {}) : _api(api), _current(new _table(64)), _epoch(0) {
+        _readers[0].store(0);
+        _readers[1].store(0);
+    }
+    // modules are closed here, module_refs must not outlive the registry
+    ~module_registry() {
+        std::unique_ptr<_table> table(_current.load(std::memory_order_relaxed));
+        for (size_t i = 0; i <= table->mask; ++i) {
+            _entry* entry = table->slots[i].load(std::memory_order_relaxed);
+            if (entry && entry != _tombstone()) { delete entry; }
+        }
+    }
+    module_registry(const module_registry&) = delete;
+    module_registry& operator=(const module_registry&) = delete;
+
+    static u64 key_of(const void* image, size_t size) { return hash::xxh64(image, size); }
+    static u64 key_of(string_view name) { return hash::xxh64(name.data(), name.size()); }
+
+    // a reference to an opened module, without waiting for one that is being opened
+    module_ref find(u64 key) {
+        _read_guard reading(*this);
+        _entry* entry = _find(key);
+        if (!entry || entry->state.load(std::memory_order_acquire) != _ready) { return {}; }
+        if (!_try_ref(entry)) { _release(entry); return {}; }
+        if (entry->state.load(std::memory_order_acquire) != _ready) { _release(entry); return {}; }
+        return {entry};
+    }
+
+    /**
+     *  Returns the module registered under key, opening image under that key if there is none.
+     *  Concurrent calls with the same key open it once, the others wait for that open and share its result.
+     *  A failed open is not remembered, the next call tries again.
+     */
+    std::pair<module_ref, errc> open(u64 key, void* image) {
+        _entry* entry = nullptr;
+        {
+            _read_guard reading(*this);
+            entry = _find(key);
+            if (entry && !_try_ref(entry)) { _release(entry); entry = nullptr; }
+        }
+        // from here on entry, if any, is held by a reference of its own
+        if (!entry) {
+            std::unique_lock<std::mutex> guard(_lock);
+            entry = _find(key);
+            if (entry && !_try_ref(entry)) { _release(entry); entry = nullptr; }
+            if (!entry) {
+                entry = _insert(key);
+                guard.unlock();
+                entry->result = entry->module.open(image);
+                guard.lock();
+                bool ok = entry->result == errc::ok;
+                entry->state.store(ok ? _ready : _failed, std::memory_order_release);
+                if (!ok) { _erase(entry); }
+                _opened.notify_all();
+                if (!ok) { _release(entry); return {module_ref(), entry->result}; }
+                return {module_ref(entry), errc::ok};
+            }
+        }
+        if (entry->state.load(std::memory_order_acquire) == _opening) {
+            std::unique_lock<std::mutex> guard(_lock);
+            _opened.wait(guard, [&] { return entry->state.load(std::memory_order_acquire) != _opening; });
+        }
+        if (entry->state.load(std::memory_order_acquire) == _failed) {
+            errc result = entry->result;
+            _release(entry);
+            return {module_ref(), result};
+        }
+        return {module_ref(entry), errc::ok};
+    }
+
+    // closes every module nobody holds a reference to, returns how many were closed
+    size_t purge() {
+        std::lock_guard<std::mutex> guard(_lock);
+        size_t closed = 0;
+        _table* table = _current.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= table->mask; ++i) {
+            _entry* entry = table->slots[i].load(std::memory_order_relaxed);
+            if (!entry || entry == _tombstone() || entry->state.load(std::memory_order_acquire) != _ready) { continue; }
+            long idle = 0;
+            if (!entry->refs.compare_exchange_strong(idle, _dead, std::memory_order_acq_rel)) { continue; }
+            entry->state.store(_failed, std::memory_order_release);
+            entry->module.close();
+            _erase(entry);
+            ++closed;
+        }
+        _reclaim();
+        return closed;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _live;
+    }
+}; // class module_registry
+
+} // namespace loader
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_RT_REGISTRY__
@@ -0,0 +1,149 @@
+#pragma once
+#ifndef __PETRICKS_RT_SYMINDEX__
+#define __PETRICKS_RT_SYMINDEX__
+
+#include <vector>
+#include "./hashtable.hpp"
+#include "./rt-reflect.hpp"
+
+/**
+ *  "Who exports X" across many modules without walking the LDR list and binary searching every export table.
+ *  symbol_index is an open addressing hash table (linear probing, backward shift deletion) from export name
+ *  to (module, rva). Names are not copied, entries point into the export name tables of the modules,
+ *  so a module must be removed from the index before it is unmapped.
+ */
+
+namespace pe {
+namespace runtime {
+namespace reflect {
+
+class symbol_index {
+public:
+    struct symbol {
+        void* module;
+        u32 rva;
+        bool forwarder; // rva points to a forwarder string, see get_proc_addr
+        explicit operator bool() const { return module != nullptr; }
+        void* address() const { return module ? ptr_at<void>(module, rva) : nullptr; }
+    }; // struct symbol
+
+private:
+    struct _entry {
+        const char* name;
+        u32 hash;
+        u32 module; // index into _modules plus one, 0 for an empty slot
+        u32 rva;
+        u32 forwarder;
+        bool empty() const { return module == 0; }
+    }; // struct _entry
+
+    pe::detail::probe_table<_entry> _slots;
+    std::vector<void*> _modules; // nullptr for a removed module, its index is reused
+
+    template <typename FuncT>
+    void _probe(string_view name, FuncT&& func) const {
+        _slots.probe(pe::detail::fnv1a(name), [&](size_t pos) {
+            stats::add(stats::counter::name_compares);
+            return !(string_view(_slots[pos].name) == name) || func(pos);
+        });
+    }
+
+    size_t _module_index(void* module) const {
+        for (size_t i = 0; i < _modules.size(); ++i) {
+            if (_modules[i] == module) { return i; }
+        }
+        return size_t(-1);
+    }
+
+public:
+    size_t size() const { return _slots.size(); }
+    size_t module_count() const {
+        size_t count = 0;
+        for (auto module : _modules) { count += module != nullptr; }
+        return count;
+    }
+
+    // adds every named export of a mapped module, returns the number of symbols added
+    size_t add_module(void* module) {
+        if (!module || _module_index(module) != size_t(-1)) { return 0; }
+        auto& opthdr = reinterpret_cast<image::dos_header*>(module)->nthdr().OptionalHeader.local;
+        image::export_view exports(module, opthdr);
+        if (!exports) { return 0; }
+
+        size_t index = _module_index(nullptr);
+        if (index == size_t(-1)) { index = _modules.size(); _modules.push_back(nullptr); }
+        _modules[index] = module;
+
+        _slots.reserve(_slots.size() + exports.names().size());
+        size_t added = 0;
+        for (auto export_ : exports) {
+            if (export_.rva == 0) { continue; }
+            _slots.insert(_entry{export_.name, pe::detail::fnv1a(export_.name), u32(index + 1), export_.rva, export_.forwarder != nullptr});
+            ++added;
+        }
+        return added;
+    }
+
+    // must be called while the module is still mapped, returns the number of symbols removed
+    size_t remove_module(void* module) {
+        size_t index = module ? _module_index(module) : size_t(-1);
+        if (index == size_t(-1)) { return 0; }
+        auto& opthdr = reinterpret_cast<image::dos_header*>(module)->nthdr().OptionalHeader.local;
+        size_t removed = 0;
+        for (auto export_ : image::export_view(module, opthdr)) {
+            size_t found = size_t(-1);
+            _probe(export_.name, [&](size_t pos) {
+                if (_slots[pos].module != index + 1) { return true; }
+                found = pos;
+                return false;
+            });
+            if (found != size_t(-1)) { _slots.erase(found); ++removed; }
+        }
+        _modules[index] = nullptr;
+        return removed;
+    }
+
+    template <typename RangeT>
+    void add_modules(RangeT&& modules) {
+        for (void* module : modules) { add_module(module); }
+    }
+
+    // every module of a loader list, the one of this process or a synthetic one
+    void add_ldr_modules(peb::ldr_data* ldr) {
+        for (auto& mod : ldr->modules(ldr_order::load)) {
+            if (!mod.DllBase) { break; }
+            add_module(mod.DllBase);
+        }
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    void add_loaded_modules() { add_ldr_modules(get_current_teb()->ProcessEnvironmentBlock->Ldr); }
+#endif
+
+    // the first exporter found, which one that is among several is unspecified
+    symbol find(string_view name) const {
+        symbol result = {nullptr, 0, false};
+        _probe(name, [&](size_t pos) {
+            auto& entry = _slots[pos];
+            result = {_modules[entry.module - 1], entry.rva, entry.forwarder != 0};
+            return false;
+        });
+        return result;
+    }
+
+    // calls func(const symbol&) for every exporter of name
+    template <typename FuncT>
+    void find_all(string_view name, FuncT&& func) const {
+        _probe(name, [&](size_t pos) {
+            auto& entry = _slots[pos];
+            func(symbol{_modules[entry.module - 1], entry.rva, entry.forwarder != 0});
+            return true;
+        });
+    }
+}; // class symbol_index
+
+} // namespace reflect
+} // namespace runtime
+} // namespace pe
+
+#endif // __PETRICKS_RT_SYMINDEX__
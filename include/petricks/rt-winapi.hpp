@@ -1,3 +1,7 @@
+#pragma once
+#ifndef __PETRICKS_RT_WINAPI__
+#define __PETRICKS_RT_WINAPI__
+
 #if __cplusplus >= 202002L
 #define PETRICKS_ENABLE_CONCEPTS
 #endif
@@ -9,7 +13,7 @@
 #include "./rt-reflect.hpp"
 
 #if !defined(_WIN32) && !defined(_WIN64)
-#error This file needs win32/win64 environment!
+#include "./rt-posix.hpp"
 #endif
 
 /**
@@ -32,7 +36,8 @@ concept winapi_provider =
     &&  requires(T self, void* lpAddress, size_t dwSize, u32 flAllocationType, u32 flProtect) { { self.VirtualAlloc(lpAddress, dwSize, flAllocationType, flProtect) } -> std::convertible_to<void*>; }
     &&  requires(T self, void* lpAddress, size_t dwSize, u32 dwFreeType) { { self.VirtualFree(lpAddress, dwSize, dwFreeType) } -> std::convertible_to<winbool>; }
     &&  requires(T self, const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength) { { self.VirtualQuery(lpAddress, lpBuffer, dwLength) } -> std::convertible_to<size_t>; }
-    &&  requires(T self, void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect) { { self.VirtualProtect(lpAddress, dwSize, flNewProtect, lpflOldProtect) } -> std::convertible_to<winbool>; };
+    &&  requires(T self, void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect) { { self.VirtualProtect(lpAddress, dwSize, flNewProtect, lpflOldProtect) } -> std::convertible_to<winbool>; }
+    &&  requires(T self) { { self.GetLargePageMinimum() } -> std::convertible_to<size_t>; };
 #endif
 
 struct winapi_dynamic {
@@ -47,7 +52,9 @@ struct winapi_dynamic {
     TyVirtualFree* VirtualFree = nullptr;
     TyVirtualQuery* VirtualQuery = nullptr;
     TyVirtualProtect* VirtualProtect = nullptr;
+    TyGetLargePageMinimum* GetLargePageMinimum = nullptr;
 
+#if defined(_WIN32) || defined(_WIN64)
     void load() {
         hKernel32 = reflect::get_module_base<wchar_t>(L"kernel32.dll");
         if (!hKernel32) { return; }
@@ -62,7 +69,9 @@ struct winapi_dynamic {
         this->VirtualFree = reinterpret_cast<TyVirtualFree*>(this->GetProcAddress(hKernel32, "VirtualFree"));
         this->VirtualQuery = reinterpret_cast<TyVirtualQuery*>(this->GetProcAddress(hKernel32, "VirtualQuery"));
         this->VirtualProtect = reinterpret_cast<TyVirtualProtect*>(this->GetProcAddress(hKernel32, "VirtualProtect"));
+        this->GetLargePageMinimum = reinterpret_cast<TyGetLargePageMinimum*>(this->GetProcAddress(hKernel32, "GetLargePageMinimum"));
     }
+#endif // _WIN32
 
     operator bool() const {
         // check them all!
@@ -76,7 +85,8 @@ struct winapi_dynamic {
             && VirtualAlloc
             && VirtualFree
             && VirtualQuery
-            && VirtualProtect;
+            && VirtualProtect
+            && GetLargePageMinimum;
     }
 }; // struct winapi_dynamic
 
@@ -99,9 +109,12 @@ struct winapi_dynamic_ref {
     winbool VirtualFree(void* lpAddress, size_t dwSize, u32 dwFreeType) { return ptr->VirtualFree(lpAddress, dwSize, dwFreeType); }
     size_t VirtualQuery(const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength) { return ptr->VirtualQuery(lpAddress, lpBuffer, dwLength); }
     winbool VirtualProtect(void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect) { return ptr->VirtualProtect(lpAddress, dwSize, flNewProtect, lpflOldProtect); }
+    size_t GetLargePageMinimum() { return ptr->GetLargePageMinimum(); }
 }; // struct winapi_dynamic_ref
 
 
+#if defined(_WIN32) || defined(_WIN64)
+
 namespace winapi {
 
 #ifndef PETRICKS_NO_STATIC_IMPORT
@@ -118,6 +131,7 @@ __declspec(dllimport) TyVirtualAlloc VirtualAlloc;
 __declspec(dllimport) TyVirtualFree VirtualFree;
 __declspec(dllimport) TyVirtualQuery VirtualQuery;
 __declspec(dllimport) TyVirtualProtect VirtualProtect;
+__declspec(dllimport) TyGetLargePageMinimum GetLargePageMinimum;
 
 } // extern "C"
 
@@ -144,6 +158,7 @@ static inline void* VirtualAlloc(void* lpAddress, size_t dwSize, u32 flAllocatio
 static inline winbool VirtualFree(void* lpAddress, size_t dwSize, u32 dwFreeType) { return __api().VirtualFree(lpAddress, dwSize, dwFreeType); }
 static inline size_t VirtualQuery(const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength) { return __api().VirtualQuery(lpAddress, lpBuffer, dwLength); }
 static inline winbool VirtualProtect(void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect) { return __api().VirtualProtect(lpAddress, dwSize, flNewProtect, lpflOldProtect); }
+static inline size_t GetLargePageMinimum() { return __api().GetLargePageMinimum(); }
 
 #endif // PETRICKS_NO_STATIC_IMPORT
 
@@ -155,15 +170,25 @@ struct winapi_default {
     static winproc GetProcAddress(handle hModule, const char* lpProcName) { return winapi::GetProcAddress(hModule, lpProcName); }
     static handle GetModuleHandleA(const char* lpModuleName) { return winapi::GetModuleHandleA(lpModuleName); }
     static handle GetModuleHandleW(const wchar_t* lpModuleName) { return winapi::GetModuleHandleW(lpModuleName); }
-    static handle LoadLibraryA(char* lpLibFileName) { return winapi::LoadLibraryA(lpLibFileName); }
-    static handle LoadLibraryW(wchar_t* lpLibFileName) { return winapi::LoadLibraryW(lpLibFileName); }
+    static handle LoadLibraryA(const char* lpLibFileName) { return winapi::LoadLibraryA(lpLibFileName); }
+    static handle LoadLibraryW(const wchar_t* lpLibFileName) { return winapi::LoadLibraryW(lpLibFileName); }
     static winbool FreeLibrary(handle hLibModule) { return winapi::FreeLibrary(hLibModule); }
     static void* VirtualAlloc(void* lpAddress, size_t dwSize, u32 flAllocationType, u32 flProtect) { return winapi::VirtualAlloc(lpAddress, dwSize, flAllocationType, flProtect); }
     static winbool VirtualFree(void* lpAddress, size_t dwSize, u32 dwFreeType) { return winapi::VirtualFree(lpAddress, dwSize, dwFreeType); }
     static size_t VirtualQuery(const void* lpAddress, memory_basic_information* lpBuffer, size_t dwLength) { return winapi::VirtualQuery(lpAddress, lpBuffer, dwLength); }
     static winbool VirtualProtect(void* lpAddress, size_t dwSize, u32 flNewProtect, u32* lpflOldProtect) { return winapi::VirtualProtect(lpAddress, dwSize, flNewProtect, lpflOldProtect); }
+    static size_t GetLargePageMinimum() { return winapi::GetLargePageMinimum(); }
 }; // struct winapi_static
 
+#else
+
+// no kernel32 to forward to, map images with mmap and resolve imports to stubs
+using winapi_default = winapi_posix;
+
+#endif // _WIN32
+
 
 } // namespace runtime
 } // namespace pe
+
+#endif // __PETRICKS_RT_WINAPI__
@@ -0,0 +1,132 @@
+#pragma once
+#ifndef __PETRICKS_STATS__
+#define __PETRICKS_STATS__
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef PETRICKS_ENABLE_STATS
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+/**
+ *  Counters of the work done by module and export lookups, compiled in with PETRICKS_ENABLE_STATS.
+ *  Without it stats::add is empty and read() returns zeros.
+ *
+ *  Each thread counts into its own block, only ever written by that thread, so counting is a plain increment
+ *  with no shared cache line. read() sums every live block plus what exited threads left behind.
+ */
+
+namespace pe {
+namespace stats {
+
+enum class counter : size_t {
+    ldr_entries, // loader list and hash bucket entries walked
+    name_compares, // module or symbol names compared
+    search_probes, // binary search steps in export name tables
+    forwarder_hops, // export forwarders followed
+}; // enum class counter
+
+constexpr size_t counter_count = 4;
+
+// for exporting, e.g. as metric names
+static inline const char* counter_name(counter which) {
+    static const char* const names[counter_count] = {
+        "ldr_entries", "name_compares", "search_probes", "forwarder_hops",
+    };
+    return names[size_t(which)];
+}
+
+struct snapshot {
+    uint64_t values[counter_count];
+
+    uint64_t operator[](counter which) const { return values[size_t(which)]; }
+}; // struct snapshot
+
+#ifdef PETRICKS_ENABLE_STATS
+constexpr bool enabled = true;
+
+namespace detail {
+
+struct block {
+    std::atomic<uint64_t> values[counter_count];
+    block() { for (auto& value : values) { value.store(0, std::memory_order_relaxed); } }
+}; // struct block
+
+struct registry {
+    std::mutex lock;
+    std::vector<std::shared_ptr<block>> blocks;
+    uint64_t retired[counter_count] = {}; // counts of exited threads
+}; // struct registry
+
+// magic statics
+inline registry& __registry() {
+    static registry reg;
+    return reg;
+}
+
+struct thread_block {
+    std::shared_ptr<block> mine = std::make_shared<block>();
+    thread_block() {
+        auto& reg = __registry();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        reg.blocks.push_back(mine);
+    }
+    ~thread_block() {
+        auto& reg = __registry();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        for (size_t i = 0; i < counter_count; ++i) { reg.retired[i] += mine->values[i].load(std::memory_order_relaxed); }
+        for (auto& other : reg.blocks) {
+            if (other == mine) { other = reg.blocks.back(); reg.blocks.pop_back(); break; }
+        }
+    }
+}; // struct thread_block
+
+inline block& local() {
+    static thread_local thread_block current;
+    return *current.mine;
+}
+
+} // namespace detail
+
+static inline void add(counter which, uint64_t count = 1) {
+    auto& value = detail::local().values[size_t(which)];
+    // the owning thread is the only writer, no read-modify-write needed
+    value.store(value.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+static inline snapshot read() {
+    snapshot total = {};
+    auto& reg = detail::__registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    for (size_t i = 0; i < counter_count; ++i) { total.values[i] = reg.retired[i]; }
+    for (auto& blk : reg.blocks) {
+        for (size_t i = 0; i < counter_count; ++i) { total.values[i] += blk->values[i].load(std::memory_order_relaxed); }
+    }
+    return total;
+}
+
+// counts taken before a reset are lost, concurrent increments may survive it
+static inline void reset() {
+    auto& reg = detail::__registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    for (auto& value : reg.retired) { value = 0; }
+    for (auto& blk : reg.blocks) {
+        for (auto& value : blk->values) { value.store(0, std::memory_order_relaxed); }
+    }
+}
+#else
+constexpr bool enabled = false;
+
+static inline void add(counter, uint64_t = 1) {}
+static inline snapshot read() { return {}; }
+static inline void reset() {}
+#endif // PETRICKS_ENABLE_STATS
+
+} // namespace stats
+} // namespace pe
+
+#endif // __PETRICKS_STATS__
@@ -0,0 +1,139 @@
+#pragma once
+#ifndef __PETRICKS_TRIAGE__
+#define __PETRICKS_TRIAGE__
+
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "./basics.hpp"
+#include "./fingerprint.hpp"
+#include "./hash.hpp"
+#include "./parallel.hpp"
+
+#if !defined(PETRICKS_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PETRICKS_TRIAGE_SSE2
+#include <emmintrin.h>
+#endif
+#endif // PETRICKS_NO_SIMD
+
+/**
+ *  Per-section digests of PE files read straight from disk, for flagging packed or otherwise odd samples:
+ *  byte entropy, xxh64 and optionally SHA-256 of the raw data of every section.
+ *  Sections are digested in parallel, biggest first, each by one thread, over the file as it is (e.g. mapped).
+ *  Raw data is bounds checked and cut at the end of the file, these are meant for untrusted samples.
+ */
+
+namespace pe {
+namespace image {
+
+/**
+ *  Adds the number of occurrences of every byte value in data to counts.
+ *  Counting goes to four tables in turn, so that a run of one value does not wait on its own increments,
+ *  and 16 bytes all alike, as in padding, are counted at once.
+ */
+static inline void byte_histogram(const void* data, size_t size, u64 counts[256]) {
+    auto bytes = static_cast<const u8*>(data);
+    // u32 counters cannot overflow within a chunk of at most 4 * 2^30 bytes
+    const size_t chunk_size = size_t(1) << 30;
+    for (size_t chunk = 0; chunk < size; chunk += chunk_size) {
+        u32 tables[4][256] = {};
+        size_t end = std::min(size, chunk + chunk_size);
+        size_t pos = chunk;
+        for (; pos + 16 <= end; pos += 16) {
+#if defined(PETRICKS_TRIAGE_SSE2)
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + pos));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(char(bytes[pos])))) == 0xFFFF) {
+                tables[0][bytes[pos]] += 16;
+                continue;
+            }
+#endif
+            u64 words[2];
+            memcpy(words, bytes + pos, sizeof(words));
+            for (u64 word : words) {
+                ++tables[0][word & 0xFF]; ++tables[1][(word >> 8) & 0xFF];
+                ++tables[2][(word >> 16) & 0xFF]; ++tables[3][(word >> 24) & 0xFF];
+                ++tables[0][(word >> 32) & 0xFF]; ++tables[1][(word >> 40) & 0xFF];
+                ++tables[2][(word >> 48) & 0xFF]; ++tables[3][word >> 56];
+            }
+        }
+        for (; pos < end; ++pos) { ++tables[0][bytes[pos]]; }
+        for (size_t i = 0; i < 256; ++i) { counts[i] += u64(tables[0][i]) + tables[1][i] + tables[2][i] + tables[3][i]; }
+    }
+}
+
+// Shannon entropy in bits per byte, 0 for constant data up to 8 for uniformly random data
+static inline double byte_entropy(const u64 counts[256]) {
+    u64 total = std::accumulate(counts, counts + 256, u64(0));
+    if (!total) { return 0; }
+    double entropy = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        if (!counts[i]) { continue; }
+        double p = double(counts[i]) / double(total);
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
+
+static inline double byte_entropy(const void* data, size_t size) {
+    u64 counts[256] = {};
+    byte_histogram(data, size, counts);
+    return byte_entropy(counts);
+}
+
+namespace digest_policy {
+constexpr u32 normal = 0; // entropy and xxh64
+constexpr u32 sha256 = 1; // SHA-256 too, several times the work of the rest
+} // namespace digest_policy
+
+struct section_digest {
+    const section_header* section; // into the file, results are in section header order
+    size_t offset; // of the raw data digested
+    size_t size; // SizeOfRawData, less what lies beyond the end of the file
+    double entropy;
+    u64 xxh64;
+    u8 sha256[hash::sha256::digest_size]; // zeros unless digest_policy::sha256
+}; // struct section_digest
+
+/**
+ *  Digests the raw data of every section of the file, on up to threads threads (the calling one included).
+ *  Empty if the headers are damaged.
+ */
+static inline std::vector<section_digest> digest_sections(const void* file, size_t size, u32 policy = digest_policy::normal,
+    size_t threads = std::thread::hardware_concurrency()) {
+    std::vector<section_digest> digests;
+    detail::file_reader reader(file, size);
+    if (!reader) { return digests; }
+    auto sechdrs = reader.nthdr().sechdrs();
+    digests.resize(sechdrs.size());
+    for (size_t i = 0; i < sechdrs.size(); ++i) {
+        auto& digest = digests[i];
+        memset(&digest, 0, sizeof(digest));
+        digest.section = &sechdrs[i];
+        digest.offset = std::min(size_t(sechdrs[i].PointerToRawData), size);
+        digest.size = std::min(size_t(sechdrs[i].SizeOfRawData), size - digest.offset);
+    }
+    // one section per task, so start with the big ones for the small ones to fill in around them
+    std::vector<size_t> order(digests.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return digests[a].size > digests[b].size; });
+    pe::detail::parallel_for(order.size(), threads ? threads : 1, [&](size_t i) {
+        auto& digest = digests[order[i]];
+        auto data = static_cast<const u8*>(file) + digest.offset;
+        digest.entropy = byte_entropy(data, digest.size);
+        digest.xxh64 = hash::xxh64(data, digest.size);
+        if (policy & digest_policy::sha256) {
+            hash::sha256 hasher;
+            hasher.update(data, digest.size);
+            hasher.finish(digest.sha256);
+        }
+    });
+    return digests;
+}
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_TRIAGE__
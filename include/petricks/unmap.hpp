@@ -0,0 +1,204 @@
+#pragma once
+#ifndef __PETRICKS_UNMAP__
+#define __PETRICKS_UNMAP__
+
+#include <cstddef>
+#include "./basics.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/**
+ *  Turns a mapped image (memory_module, an LDR entry's DllBase, a rebased buffer ...) back into file layout.
+ *  The image is emitted as a sequence of (pointer, size) pieces in file order, straight from the mapping,
+ *  with gaps filled from a shared zero page, so nothing is allocated or copied on the way.
+ */
+
+namespace pe {
+namespace image {
+
+// every section of an image mapped by the system loader is readable
+struct all_sections_present {
+    bool operator()(section_header&) const { return true; }
+}; // struct all_sections_present
+
+namespace detail {
+
+static inline const u8* zero_page() {
+    static const u8 zeros[0x1000] = {};
+    return zeros;
+}
+
+template <typename SinkT>
+static inline void emit_zeros(SinkT& sink, size_t size) {
+    for (; size > 0x1000; size -= 0x1000) { sink(zero_page(), 0x1000); }
+    if (size) { sink(zero_page(), size); }
+}
+
+template <typename OpthdrT, typename SinkT, typename PresentT>
+static inline size_t unmap_pieces(image_view<OpthdrT>& view, SinkT& sink, const typename image_view<OpthdrT>::va_type* image_base, PresentT& present) {
+    auto& opthdr = view.opthdr();
+    auto headers = static_cast<const u8*>(view.base());
+    size_t pos = 0;
+
+    // headers, optionally with a different ImageBase
+    if (image_base) {
+        size_t base_pos = reinterpret_cast<const u8*>(&opthdr.ImageBase) - headers;
+        sink(headers, base_pos);
+        sink(image_base, sizeof(*image_base));
+        pos = base_pos + sizeof(*image_base);
+    }
+    sink(headers + pos, opthdr.SizeOfHeaders - pos);
+    pos = opthdr.SizeOfHeaders;
+
+    // sections in file order, picked by selection so that nothing needs sorting storage
+    auto sechdrs = view.sechdrs();
+    size_t last_raw = 0; bool first = true;
+    for (size_t emitted = 0; emitted < sechdrs.size(); ++emitted) {
+        section_header* next = nullptr;
+        for (auto& sechdr : sechdrs) {
+            if (sechdr.SizeOfRawData == 0) { continue; }
+            if (!first && sechdr.PointerToRawData <= last_raw) { continue; }
+            if (!next || sechdr.PointerToRawData < next->PointerToRawData) { next = &sechdr; }
+        }
+        if (!next) { break; }
+        first = false; last_raw = next->PointerToRawData;
+        if (next->PointerToRawData < pos) { continue; } // overlaps what was written already
+        emit_zeros(sink, next->PointerToRawData - pos);
+        pos = next->PointerToRawData;
+
+        // raw data past the section's virtual extent is not mapped, a broken header without alignment maps all of it
+        size_t alignment = opthdr.SectionAlignment;
+        size_t mapped = next->Misc.VirtualSize && alignment
+            ? (size_t(next->Misc.VirtualSize) + alignment - 1) / alignment * alignment
+            : next->SizeOfRawData;
+        size_t take = present(*next) ? std::min<size_t>(next->SizeOfRawData, mapped) : 0;
+        if (take) { sink(view.template at<u8>(next->VirtualAddress), take); }
+        emit_zeros(sink, next->SizeOfRawData - take);
+        pos += next->SizeOfRawData;
+    }
+    return pos;
+}
+
+template <typename SinkT, typename PresentT>
+struct unmap_visitor {
+    SinkT& sink; bool fix_image_base; PresentT& present;
+    template <typename ViewT>
+    size_t operator()(ViewT& view) {
+        typename ViewT::va_type base = typename ViewT::va_type(reinterpret_cast<size_t>(view.base()));
+        return unmap_pieces(view, sink, fix_image_base ? &base : nullptr, present);
+    }
+}; // struct unmap_visitor
+
+struct size_sink {
+    void operator()(const void*, size_t) {}
+}; // struct size_sink
+
+struct copy_sink {
+    u8* out;
+    void operator()(const void* data, size_t size) { memcpy(out, data, size); out += size; }
+}; // struct copy_sink
+
+struct revert_visitor {
+    u8* file; u64 restore_base;
+    template <typename ViewT>
+    void operator()(ViewT& view) {
+        auto& nthdr = view.nthdr();
+        auto& opthdr = view.opthdr();
+        u64 delta = restore_base - u64(opthdr.ImageBase);
+        auto& reloc_pos = opthdr.datadir(directory_entry::basereloc);
+        if (reloc_pos.Size && delta) {
+            size_t offset = nthdr.rva_to_offset(reloc_pos.VirtualAddress);
+            if (offset == size_t(-1)) { return; }
+            for (auto& block : sentinel_view<base_relocation>(ptr_at<base_relocation>(file, offset))) {
+                size_t page = nthdr.rva_to_offset(block.VirtualAddress);
+                if (page != size_t(-1)) { apply_relocation_block(block, file + page, delta); }
+            }
+        }
+        opthdr.ImageBase = decltype(opthdr.ImageBase)(restore_base);
+    }
+}; // struct revert_visitor
+
+#if defined(__unix__) || defined(__APPLE__)
+struct gather_sink {
+    static constexpr int max_pieces = 64;
+    int fd; int count; bool ok;
+    iovec iov[max_pieces];
+    u64 stash[max_pieces]; // small pieces (the patched ImageBase) may not outlive the call
+
+    void flush() {
+        iovec* first = iov; int left = count;
+        while (ok && left) {
+            ssize_t written = writev(fd, first, left);
+            if (written <= 0) { ok = false; break; }
+            // partial write, skip what has been written
+            for (size_t w = size_t(written); w && left; ) {
+                if (w >= first->iov_len) { w -= first->iov_len; ++first; --left; }
+                else { first->iov_base = static_cast<u8*>(first->iov_base) + w; first->iov_len -= w; w = 0; }
+            }
+        }
+        count = 0;
+    }
+    void operator()(const void* data, size_t size) {
+        if (!size) { return; }
+        if (count == max_pieces) { flush(); }
+        if (size <= sizeof(u64)) { memcpy(&stash[count], data, size); data = &stash[count]; }
+        iov[count].iov_base = const_cast<void*>(data);
+        iov[count].iov_len = size;
+        ++count;
+    }
+}; // struct gather_sink
+#endif
+
+} // namespace detail
+
+/**
+ *  Emits the file layout of the image mapped at base through sink(const void* data, size_t size), in file order.
+ *  fix_image_base writes the mapping address as ImageBase, which is what the relocated contents match.
+ *  present tells whether a section can be read, see memory_module::unmap for a loader that discards sections.
+ *  Returns the resulting file size.
+ */
+template <typename SinkT, typename PresentT = all_sections_present>
+static inline size_t unmap_image(void* base, SinkT&& sink, bool fix_image_base = false, PresentT present = {}) {
+    detail::unmap_visitor<typename std::remove_reference<SinkT>::type, PresentT> visitor{sink, fix_image_base, present};
+    return visit_image(base, visitor);
+}
+
+static inline size_t unmapped_size(void* base) {
+    return unmap_image(base, detail::size_sink{});
+}
+
+/**
+ *  Copies the file layout into out, which must hold unmapped_size(base) bytes.
+ *  A non-zero restore_base reverts relocations so that the file matches that ImageBase again
+ *  (typically the original one), assuming the contents match the ImageBase in the mapped headers.
+ *  Otherwise ImageBase is set to the mapping address.
+ */
+template <typename PresentT = all_sections_present>
+static inline size_t unmap_image_copy(void* base, void* out, u64 restore_base = 0, PresentT present = {}) {
+    auto size = unmap_image(base, detail::copy_sink{static_cast<u8*>(out)}, !restore_base, present);
+    if (restore_base) { visit_image(out, detail::revert_visitor{static_cast<u8*>(out), restore_base}); }
+    return size;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ *  Writes the file layout to fd with gathered writes, a batch of pieces per writev.
+ *  Returns false on a write error.
+ */
+template <typename PresentT = all_sections_present>
+static inline bool unmap_image_to_fd(void* base, int fd, bool fix_image_base = false, PresentT present = {}) {
+    detail::gather_sink sink;
+    sink.fd = fd; sink.count = 0; sink.ok = true;
+    unmap_image(base, sink, fix_image_base, present);
+    sink.flush();
+    return sink.ok;
+}
+#endif
+
+} // namespace image
+} // namespace pe
+
+#endif // __PETRICKS_UNMAP__
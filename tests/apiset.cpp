@@ -0,0 +1,231 @@
+/**
+ *  api_set_map over small schemas of version 2, 4 and 6 laid out the way the system lays them out:
+ *  case folding, the extension and (from version 6 on) the minor version left out of the lookup,
+ *  importer aliases, unknown contracts, and blobs cut short.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "petricks/apiset.hpp"
+
+using namespace pe;
+using namespace pe::runtime::reflect;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what, u32 version) {
+    if (!ok) { fprintf(stderr, "v%u failed: %s\n", version, what); ++failures; }
+}
+
+struct value_spec {
+    const char* importer; // empty for the default host
+    const char* host;
+}; // struct value_spec
+
+struct contract_spec {
+    const char* name; // as the version 6 schema stores it, with its prefix and without extension
+    std::vector<value_spec> values;
+}; // struct contract_spec
+
+const std::vector<contract_spec> contracts = {
+    {"api-ms-win-core-console-l1-1-0", {{"", "KERNEL32.dll"}}},
+    {"api-ms-win-core-synch-l1-2-0", {{"", "kernel32.dll"}, {"KERNEL32.dll", "kernelbase.dll"}}},
+    {"ext-ms-win-gdi-draw-l1-1-1", {{"", "gdi32full.dll"}}},
+    {"api-ms-win-core-hostless-l1-1-0", {}},
+};
+
+class blob_writer {
+    std::vector<u8> _data;
+
+public:
+    const std::vector<u8>& data() const { return _data; }
+    u32 size() const { return u32(_data.size()); }
+
+    template <typename T>
+    u32 reserve(u32 count = 1) {
+        u32 pos = size();
+        _data.resize(_data.size() + sizeof(T) * count, 0);
+        return pos;
+    }
+
+    template <typename T>
+    T& at(u32 pos, u32 index = 0) { return reinterpret_cast<T*>(&_data[pos])[index]; }
+
+    // UTF-16, not terminated; may move the data, so take references with at() only after it
+    u32 name(string_view text) {
+        u32 pos = size();
+        for (size_t i = 0; i < text.size(); ++i) {
+            u16 ch = u8(text[i]);
+            _data.push_back(u8(ch)); _data.push_back(u8(ch >> 8));
+        }
+        return pos;
+    }
+}; // class blob_writer
+
+u32 length_of(const char* text) { return u32(strlen(text) * 2); }
+
+// versions 2 and 4 store contracts without their prefix
+const char* stored_v2_name(const char* name) { return name + 4; }
+
+std::vector<u8> build_v2() {
+    blob_writer blob;
+    u32 header = blob.reserve<api_set_namespace_v2>();
+    blob.at<api_set_namespace_v2>(header) = {2, u32(contracts.size())};
+    u32 entries = blob.reserve<api_set_namespace_entry_v2>(u32(contracts.size()));
+    for (u32 i = 0; i < contracts.size(); ++i) {
+        auto& contract = contracts[i];
+        u32 values = blob.reserve<api_set_value_array_v2>();
+        blob.at<api_set_value_array_v2>(values).Count = u32(contract.values.size());
+        u32 value = blob.reserve<api_set_value_entry_v2>(u32(contract.values.size()));
+        blob.at<api_set_namespace_entry_v2>(entries, i) = {0, length_of(stored_v2_name(contract.name)), values};
+        for (u32 j = 0; j < contract.values.size(); ++j) {
+            blob.at<api_set_value_entry_v2>(value, j) = {0, length_of(contract.values[j].importer), 0, length_of(contract.values[j].host)};
+        }
+    }
+    // names last, so that cutting the blob short leaves offsets pointing past it
+    for (u32 i = 0; i < contracts.size(); ++i) {
+        auto& contract = contracts[i];
+        u32 name = blob.name(stored_v2_name(contract.name));
+        blob.at<api_set_namespace_entry_v2>(entries, i).NameOffset = name;
+        u32 value = blob.at<api_set_namespace_entry_v2>(entries, i).DataOffset + sizeof(api_set_value_array_v2);
+        for (u32 j = 0; j < contract.values.size(); ++j) {
+            u32 importer = blob.name(contract.values[j].importer);
+            blob.at<api_set_value_entry_v2>(value, j).NameOffset = importer;
+            u32 host = blob.name(contract.values[j].host);
+            blob.at<api_set_value_entry_v2>(value, j).ValueOffset = host;
+        }
+    }
+    return blob.data();
+}
+
+std::vector<u8> build_v4() {
+    blob_writer blob;
+    u32 header = blob.reserve<api_set_namespace_v4>();
+    u32 entries = blob.reserve<api_set_namespace_entry_v4>(u32(contracts.size()));
+    for (u32 i = 0; i < contracts.size(); ++i) {
+        auto& contract = contracts[i];
+        u32 values = blob.reserve<api_set_value_array_v4>();
+        blob.at<api_set_value_array_v4>(values) = {0, u32(contract.values.size())};
+        u32 value = blob.reserve<api_set_value_entry_v4>(u32(contract.values.size()));
+        blob.at<api_set_namespace_entry_v4>(entries, i) = {0, 0, length_of(stored_v2_name(contract.name)), 0, 0, values};
+        for (u32 j = 0; j < contract.values.size(); ++j) {
+            blob.at<api_set_value_entry_v4>(value, j) = {0, 0, length_of(contract.values[j].importer), 0, length_of(contract.values[j].host)};
+        }
+    }
+    for (u32 i = 0; i < contracts.size(); ++i) {
+        auto& contract = contracts[i];
+        u32 name = blob.name(stored_v2_name(contract.name));
+        blob.at<api_set_namespace_entry_v4>(entries, i).NameOffset = name;
+        blob.at<api_set_namespace_entry_v4>(entries, i).AliasOffset = name;
+        blob.at<api_set_namespace_entry_v4>(entries, i).AliasLength = length_of(stored_v2_name(contract.name));
+        u32 value = blob.at<api_set_namespace_entry_v4>(entries, i).DataOffset + sizeof(api_set_value_array_v4);
+        for (u32 j = 0; j < contract.values.size(); ++j) {
+            u32 importer = blob.name(contract.values[j].importer);
+            blob.at<api_set_value_entry_v4>(value, j).NameOffset = importer;
+            u32 host = blob.name(contract.values[j].host);
+            blob.at<api_set_value_entry_v4>(value, j).ValueOffset = host;
+        }
+    }
+    blob.at<api_set_namespace_v4>(header) = {4, blob.size(), 0, u32(contracts.size())};
+    return blob.data();
+}
+
+std::vector<u8> build_v6() {
+    const u32 hash_factor = 0x1f;
+    blob_writer blob;
+    u32 header = blob.reserve<api_set_namespace_v6>();
+    u32 entries = blob.reserve<api_set_namespace_entry_v6>(u32(contracts.size()));
+    u32 hashes = blob.reserve<api_set_hash_entry_v6>(u32(contracts.size()));
+    std::vector<api_set_hash_entry_v6> hash_table;
+    for (u32 i = 0; i < contracts.size(); ++i) {
+        auto& contract = contracts[i];
+        string_view name(contract.name);
+        size_t hashed = name.size();
+        while (hashed && name[hashed - 1] != '-') { --hashed; }
+        --hashed;
+        u32 value = blob.reserve<api_set_value_entry_v6>(u32(contract.values.size()));
+        blob.at<api_set_namespace_entry_v6>(entries, i) = {0, 0, length_of(contract.name), u32(hashed * 2), value, u32(contract.values.size())};
+        for (u32 j = 0; j < contract.values.size(); ++j) {
+            blob.at<api_set_value_entry_v6>(value, j) = {0, 0, length_of(contract.values[j].importer), 0, length_of(contract.values[j].host)};
+        }
+        u32 hash = 0;
+        for (size_t k = 0; k < hashed; ++k) { hash = hash * hash_factor + u8(name[k]); }
+        hash_table.push_back({hash, i});
+    }
+    std::sort(hash_table.begin(), hash_table.end(), [](const api_set_hash_entry_v6& a, const api_set_hash_entry_v6& b) { return a.Hash < b.Hash; });
+    for (u32 i = 0; i < hash_table.size(); ++i) { blob.at<api_set_hash_entry_v6>(hashes, i) = hash_table[i]; }
+    for (u32 i = 0; i < contracts.size(); ++i) {
+        auto& contract = contracts[i];
+        u32 name = blob.name(contract.name);
+        blob.at<api_set_namespace_entry_v6>(entries, i).NameOffset = name;
+        u32 value = blob.at<api_set_namespace_entry_v6>(entries, i).ValueOffset;
+        for (u32 j = 0; j < contract.values.size(); ++j) {
+            u32 importer = blob.name(contract.values[j].importer);
+            blob.at<api_set_value_entry_v6>(value, j).NameOffset = importer;
+            u32 host = blob.name(contract.values[j].host);
+            blob.at<api_set_value_entry_v6>(value, j).ValueOffset = host;
+        }
+    }
+    blob.at<api_set_namespace_v6>(header) = {6, blob.size(), 0, u32(contracts.size()), entries, hashes, hash_factor};
+    return blob.data();
+}
+
+bool resolves_to(const api_set_map& map, const char* contract, const char* host, const char* importer = nullptr) {
+    auto found = map.resolve(contract, importer);
+    return found == string_view(host) && found.data()[found.size()] == 0;
+}
+
+void check_schema(const std::vector<u8>& blob, u32 version) {
+    api_set_map map;
+    check(map.parse(blob.data(), blob.size()), "parse", version);
+    check(map.version() == version && map.size() == contracts.size(), "version and size", version);
+
+    check(resolves_to(map, "api-ms-win-core-console-l1-1-0.dll", "kernel32.dll"), "host in lower case", version);
+    check(resolves_to(map, "API-MS-Win-Core-Console-L1-1-0.DLL", "kernel32.dll"), "contract in any case", version);
+    check(resolves_to(map, "api-ms-win-core-console-l1-1-0", "kernel32.dll"), "contract without extension", version);
+    check(resolves_to(map, "ext-ms-win-gdi-draw-l1-1-1.dll", "gdi32full.dll"), "ext- prefix", version);
+
+    check(resolves_to(map, "api-ms-win-core-synch-l1-2-0.dll", "kernel32.dll"), "default host", version);
+    check(resolves_to(map, "api-ms-win-core-synch-l1-2-0.dll", "kernelbase.dll", "kernel32"), "alias for the importer", version);
+    check(resolves_to(map, "api-ms-win-core-synch-l1-2-0.dll", "kernelbase.dll", "Kernel32.DLL"), "importer in any case", version);
+    check(resolves_to(map, "api-ms-win-core-synch-l1-2-0.dll", "kernel32.dll", "user32.dll"), "default host for other importers", version);
+    if (version >= 6) {
+        check(resolves_to(map, "api-ms-win-core-synch-l1-2-1.dll", "kernel32.dll"), "minor version left out", version);
+        check(resolves_to(map, "API-MS-WIN-CORE-SYNCH-L1-2-7", "kernel32.dll"), "minor version left out, any case, no extension", version);
+    } else {
+        check(resolves_to(map, "api-ms-win-core-synch-l1-2-1.dll", ""), "minor version compared", version);
+    }
+
+    check(resolves_to(map, "api-ms-win-core-hostless-l1-1-0.dll", ""), "contract without host", version);
+    check(resolves_to(map, "api-ms-win-core-unknown-l1-1-0.dll", ""), "unknown contract", version);
+    check(resolves_to(map, "api-ms-win-core-console-l1-1", ""), "contract cut short", version);
+    check(resolves_to(map, "kernel32.dll", "") && !api_set_map::is_contract("kernel32.dll"), "not a contract", version);
+    check(api_set_map::is_contract("API-ms-win-core-console-l1-1-0.dll") && api_set_map::is_contract("Ext-ms-win-gdi-draw-l1-1-1"), "is_contract", version);
+
+    // every cut short of the whole blob leaves some record or name outside of it
+    bool rejected = true;
+    for (size_t size = 0; size < blob.size(); ++size) {
+        if (map.parse(blob.data(), size) || map.size() || map.version()) { rejected = false; }
+    }
+    check(rejected, "truncated blob", version);
+    check(resolves_to(map, "api-ms-win-core-console-l1-1-0.dll", ""), "empty after a failed parse", version);
+}
+
+} // namespace
+
+int main() {
+    check_schema(build_v2(), 2);
+    check_schema(build_v4(), 4);
+    check_schema(build_v6(), 6);
+
+    std::vector<u8> unknown = build_v6();
+    unknown[0] = 5;
+    api_set_map map;
+    check(!map.parse(unknown.data(), unknown.size()) && !map, "unknown version", 5);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+/**
+ *  imphash of a PE32+ file importing ws2_32, oleaut32 and wsock32 by ordinal only, including ordinals beyond
+ *  the classic winsock 1.1 range and ones no table names. The expected digest is pefile's get_imphash().
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "petricks/fingerprint.hpp"
+
+using namespace pe;
+using namespace pe::image;
+
+namespace {
+
+struct import_spec {
+    const char* dll;
+    std::vector<u16> ordinals;
+}; // struct import_spec
+
+// headers in the first 0x200 bytes, everything else in one section at RVA 0x1000, file offset 0x200
+std::vector<u8> build_file(const std::vector<import_spec>& imports) {
+    const u32 section_rva = 0x1000, section_offset = 0x200;
+    std::vector<u8> data;
+    auto reserve = [&](size_t size) { size_t pos = data.size(); data.resize(pos + ((size + 7) & ~size_t(7)), 0); return u32(pos); };
+
+    u32 descs = reserve(sizeof(import_descriptor) * (imports.size() + 1));
+    for (size_t i = 0; i < imports.size(); ++i) {
+        u32 name = reserve(strlen(imports[i].dll) + 1);
+        memcpy(&data[name], imports[i].dll, strlen(imports[i].dll));
+        u32 thunks = reserve(sizeof(u64) * (imports[i].ordinals.size() + 1));
+        for (size_t j = 0; j < imports[i].ordinals.size(); ++j) {
+            u64 thunk = (u64(1) << 63) | imports[i].ordinals[j];
+            memcpy(&data[thunks + j * sizeof(u64)], &thunk, sizeof(thunk));
+        }
+        import_descriptor desc = {};
+        desc.OriginalFirstThunk = section_rva + thunks;
+        desc.Name = section_rva + name;
+        desc.FirstThunk = section_rva + thunks;
+        memcpy(&data[descs + i * sizeof(import_descriptor)], &desc, sizeof(desc));
+    }
+
+    std::vector<u8> file(section_offset + data.size(), 0);
+    auto& doshdr = ref_at<dos_header>(file.data());
+    doshdr.e_magic = dos_signature;
+    doshdr.e_lfanew = 0x40;
+    auto& nthdr = doshdr.nthdr();
+    nthdr.Signature = nt_signature;
+    nthdr.FileHeader.NumberOfSections = 1;
+    nthdr.FileHeader.SizeOfOptionalHeader = sizeof(optional_header64);
+    auto& opthdr = nthdr.OptionalHeader.x64;
+    opthdr.Magic = nt_optional_hdr64_magic;
+    opthdr.SizeOfHeaders = section_offset;
+    opthdr.NumberOfRvaAndSizes = numberof_directory_entries;
+    opthdr.datadir(directory_entry::import_) = {section_rva + descs, u32(sizeof(import_descriptor) * (imports.size() + 1))};
+    auto& sechdr = nthdr.sechdrs()[0];
+    memcpy(sechdr.Name, ".idata", 6);
+    sechdr.VirtualAddress = section_rva;
+    sechdr.Misc.VirtualSize = u32(data.size());
+    sechdr.SizeOfRawData = u32(data.size());
+    sechdr.PointerToRawData = section_offset;
+    memcpy(&file[section_offset], data.data(), data.size());
+    return file;
+}
+
+} // namespace
+
+int main() {
+    auto file = build_file({
+        {"WS2_32.dll", {58, 76, 99, 100, 115, 151}},
+        {"OLEAUT32.dll", {41, 200, 302, 443}},
+        {"wsock32.dll", {3}},
+    });
+    u8 digest[16];
+    if (!imphash(file.data(), file.size(), digest)) { fprintf(stderr, "imphash failed\n"); return 1; }
+    char hex[33];
+    for (size_t i = 0; i < sizeof(digest); ++i) { snprintf(hex + i * 2, 3, "%02x", digest[i]); }
+    // ws2_32.wsainstallserviceclassa,ws2_32.wsasend,ws2_32.getnameinfo,ws2_32.ord100,ws2_32.wsastartup,
+    // ws2_32.__wsafdisset,oleaut32.safearrayallocdescriptorex,oleaut32.geterrorinfo,oleaut32.ord302,
+    // oleaut32.unregistertypelibforuser,wsock32.closesocket
+    const char* expected = "97b6c94ffed902b139727b3b2c0c3997";
+    if (strcmp(hex, expected) != 0) { fprintf(stderr, "imphash %s, expected %s\n", hex, expected); return 1; }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ *  The loader hash bucket lookup against synthetic module lists: the name hash, the walk of one bucket, and
+ *  locating the bucket array from the rings, including a loader that buckets by first letter like Windows 7.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "petricks/rt-reflect.hpp"
+
+using namespace pe;
+using namespace pe::runtime;
+using namespace pe::runtime::reflect;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) { fprintf(stderr, "failed: %s\n", what); ++failures; }
+}
+
+static inline void link_tail(list_entry& head, list_entry& node) {
+    node.Flink = &head;
+    node.Blink = head.Blink;
+    head.Blink->Flink = &node;
+    head.Blink = &node;
+}
+
+// a process whose bucket array lives inside the image of the ntdll entry
+struct fake_loader {
+    struct module {
+        ldr_data_table_entry entry;
+        std::wstring name;
+    }; // struct module
+
+    list_entry table[ldr_hash_buckets];
+    list_entry load_order;
+    std::vector<std::unique_ptr<module>> modules;
+
+    template <typename BucketT>
+    fake_loader(const std::vector<const char*>& names, BucketT&& bucket_of) {
+        load_order.Flink = load_order.Blink = &load_order;
+        for (auto& head : table) { head.Flink = head.Blink = &head; }
+        for (auto name : names) {
+            std::unique_ptr<module> mod(new module());
+            mod->name.assign(name, name + strlen(name));
+            auto& entry = mod->entry;
+            entry.BaseDllName.Buffer = &mod->name[0];
+            entry.BaseDllName.Length = u16(mod->name.size() * sizeof(wchar_t));
+            entry.BaseDllName.MaximumLength = entry.BaseDllName.Length;
+            entry.DllBase = mod.get();
+            entry.SizeOfImage = sizeof(module);
+            link_tail(load_order, entry.InLoadOrderLinks);
+            link_tail(table[bucket_of(wstring_view(mod->name.c_str()))], entry.HashLinks);
+            modules.push_back(std::move(mod));
+        }
+        auto& ntdll = *find("ntdll.dll");
+        ntdll.DllBase = table;
+        ntdll.SizeOfImage = sizeof(table);
+    }
+
+    ldr_data_table_entry* find(const char* name) {
+        for (auto& mod : modules) {
+            if (dll_name_cmp<wchar_t, char>(mod->entry.BaseDllName, name)) { return &mod->entry; }
+        }
+        return nullptr;
+    }
+}; // struct fake_loader
+
+const std::vector<const char*> module_names = {
+    "app.exe", "ntdll.dll", "KERNEL32.DLL", "KERNELBASE.dll", "shell32.dll", "win32u.dll", "shlwapi.dll",
+    "rpcrt4.dll", "crypt32.dll", "ws2_32.dll", "imm32.dll", "advapi32.dll",
+};
+
+} // namespace
+
+int main() {
+    // x65599 over the upcased name
+    check(ldr_hash_name(string_view("ntdll.dll")) == 0xf46857d4, "ldr_hash_name of ntdll.dll");
+    check(ldr_hash_name(wstring_view(L"NTDLL.DLL")) == ldr_hash_name(string_view("ntdll.dll")), "ldr_hash_name folds case");
+    check(ldr_hash_bucket(string_view("kernel32.dll")) == 18, "bucket of kernel32.dll");
+    check(ldr_hash_bucket(string_view("KERNEL32")) == 18, "a name without extension hashes as .dll");
+    check(ldr_hash_bucket(string_view("app.exe")) == 5, "another extension is kept");
+
+    fake_loader loader(module_names, [](wstring_view name) { return ldr_hash_bucket(name); });
+    auto table = find_ldr_hash_table(&loader.load_order, *loader.find("ntdll.dll"));
+    check(table == loader.table, "find_ldr_hash_table locates the array");
+    if (table != loader.table) { return 1; }
+
+    // win32u.dll and shlwapi.dll, rpcrt4.dll and crypt32.dll share their buckets
+    for (auto name : module_names) {
+        auto mod = find_module_in_bucket(&table[ldr_hash_bucket(string_view(name))], string_view(name));
+        check(mod == loader.find(name), name);
+    }
+    check(find_module_in_bucket(&table[ldr_hash_bucket(string_view("Shlwapi"))], string_view("Shlwapi")) == loader.find("shlwapi.dll"),
+        "lookup without extension, in another case");
+    check(find_module_in_bucket(&table[ldr_hash_bucket(string_view("user32.dll"))], string_view("user32.dll")) == nullptr,
+        "a module that is not loaded");
+    check(find_module_in_bucket(&table[ldr_hash_bucket(string_view("kernel32.dll"))], string_view("shell32.dll")) == nullptr,
+        "the wrong bucket");
+
+    // buckets by first letter: the table start derived from the first module does not fit the others
+    fake_loader first_letter(module_names, [](wstring_view name) {
+        u32 ch = u32(name[0]);
+        if (ch >= 'a' && ch <= 'z') { ch -= 'a' - 'A'; }
+        return (ch - 'A') & (ldr_hash_buckets - 1);
+    });
+    check(find_ldr_hash_table(&first_letter.load_order, *first_letter.find("ntdll.dll")) == nullptr, "a table bucketed otherwise is rejected");
+
+    // no ring passes through ntdll
+    fake_loader elsewhere(module_names, [](wstring_view name) { return ldr_hash_bucket(name); });
+    ldr_data_table_entry outside = {};
+    check(find_ldr_hash_table(&elsewhere.load_order, outside) == nullptr, "no table outside the owner");
+    return failures ? 1 : 0;
+}
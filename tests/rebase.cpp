@@ -0,0 +1,148 @@
+/**
+ *  Moving a mapped image: image::rebase_image on a plain copy and memory_module::relocate_to under winapi_posix
+ *  both have to give what a fresh map at the target base gives, with the state of the moved module kept.
+ *  A mapping on large pages is left as it was allocated and moves onto normal pages.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "petricks/rt-loader.hpp"
+
+using namespace pe;
+using namespace pe::image;
+using namespace pe::runtime;
+using namespace pe::runtime::loader;
+
+namespace {
+
+using va_type = image_traits<optional_header>::va_type;
+
+const u32 data_rva = 0x1000, bss_rva = 0x2000, reloc_rva = 0x3000, image_size = 0x4000;
+const u32 pointer_count = 16;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) { fprintf(stderr, "failed: %s\n", what); ++failures; }
+}
+
+// .data full of pointers into the image, .bss without raw data, .reloc for the pointers
+std::vector<u8> build_file(u64 image_base) {
+    const u32 headers_size = 0x400, raw_size = 0x200;
+    std::vector<u8> file(headers_size + raw_size * 2, 0);
+    auto& doshdr = ref_at<dos_header>(file.data());
+    doshdr.e_magic = dos_signature;
+    doshdr.e_lfanew = 0x40;
+    auto& nthdr = doshdr.nthdr();
+    nthdr.Signature = nt_signature;
+    nthdr.FileHeader.Machine = u16(file_machine::local);
+    nthdr.FileHeader.NumberOfSections = 3;
+    nthdr.FileHeader.SizeOfOptionalHeader = sizeof(optional_header);
+    auto& opthdr = nthdr.OptionalHeader.local;
+    opthdr.Magic = image_traits<optional_header>::magic;
+    opthdr.ImageBase = va_type(image_base);
+    opthdr.SectionAlignment = 0x1000;
+    opthdr.FileAlignment = raw_size;
+    opthdr.SizeOfImage = image_size;
+    opthdr.SizeOfHeaders = headers_size;
+    opthdr.NumberOfRvaAndSizes = numberof_directory_entries;
+
+    auto sechdrs = nthdr.sechdrs();
+    memcpy(sechdrs[0].Name, ".data", 5);
+    sechdrs[0].VirtualAddress = data_rva;
+    sechdrs[0].Misc.VirtualSize = 0x1000;
+    sechdrs[0].SizeOfRawData = raw_size;
+    sechdrs[0].PointerToRawData = headers_size;
+    sechdrs[0].Characteristics = scn::cnt_initialized_data | scn::mem_read | scn::mem_write;
+    memcpy(sechdrs[1].Name, ".bss", 4);
+    sechdrs[1].VirtualAddress = bss_rva;
+    sechdrs[1].Misc.VirtualSize = 0x1000;
+    sechdrs[1].Characteristics = scn::cnt_uninitialized_data | scn::mem_read | scn::mem_write;
+    memcpy(sechdrs[2].Name, ".reloc", 6);
+    sechdrs[2].VirtualAddress = reloc_rva;
+    sechdrs[2].Misc.VirtualSize = 0x1000;
+    sechdrs[2].SizeOfRawData = raw_size;
+    sechdrs[2].PointerToRawData = headers_size + raw_size;
+    sechdrs[2].Characteristics = scn::cnt_initialized_data | scn::mem_read | scn::mem_discardable;
+
+    u16 type = u16(sizeof(va_type) == 8 ? rel_based::dir64 : rel_based::highlow);
+    auto block = ptr_at<u8>(file.data(), headers_size + raw_size);
+    u32 block_size = u32(8 + 2 * pointer_count);
+    memcpy(block, &data_rva, 4);
+    memcpy(block + 4, &block_size, 4);
+    for (u32 i = 0; i < pointer_count; ++i) {
+        // every other pointer goes into .bss
+        va_type target = va_type(image_base + (i % 2 ? bss_rva + i : data_rva + i * 4));
+        memcpy(ptr_at<u8>(file.data(), headers_size + i * sizeof(va_type)), &target, sizeof(target));
+        u16 entry = u16((type << 12) | (i * sizeof(va_type)));
+        memcpy(block + 8 + 2 * i, &entry, 2);
+    }
+    opthdr.datadir(directory_entry::basereloc) = {reloc_rva, block_size};
+    return file;
+}
+
+std::vector<u8> image_of(void* base) {
+    auto bytes = static_cast<u8*>(base);
+    return std::vector<u8>(bytes, bytes + image_size);
+}
+
+// an address where the image fits, free again by the time it is used
+void* free_range() {
+    void* range = winapi_posix::VirtualAlloc(nullptr, image_size, mem::reserve, page::readwrite);
+    winapi_posix::VirtualFree(range, 0, mem::release);
+    return range;
+}
+
+u32 protection_at(void* base, u32 rva) {
+    memory_basic_information info = {};
+    if (!winapi_posix::VirtualQuery(ptr_at<void>(base, rva), &info, sizeof(info))) { return 0; }
+    return info.Protect;
+}
+
+} // namespace
+
+int main() {
+    auto file = build_file(0x10000000);
+    memory_module<winapi_posix> module;
+    if (module.map(file.data()) != memory_module<winapi_posix>::errc::ok) { fprintf(stderr, "map failed\n"); return 1; }
+    // state the module built up, which a remap would lose
+    *ptr_at<u8>(module.base_addr(), bss_rva + 0x10) = 0x5a;
+
+    void* target = free_range();
+    auto rebased = image_of(module.base_addr());
+    rebase_image(rebased.data(), reinterpret_cast<size_t>(target));
+
+    check(module.relocate_to(target) == memory_module<winapi_posix>::errc::ok, "relocate_to");
+    check(module.base_addr() == target, "relocate_to lands at the target");
+    if (module.base_addr() != target) { return 1; }
+    auto moved = image_of(target);
+    check(moved == rebased, "relocate_to and rebase_image agree");
+    check(moved[bss_rva + 0x10] == 0x5a, "state in .bss moves along");
+    va_type first;
+    memcpy(&first, &moved[data_rva], sizeof(first));
+    check(first == va_type(reinterpret_cast<size_t>(target) + data_rva), "pointers follow the image");
+    module.close();
+
+    // what the loader would have produced at the target in the first place
+    auto at_target = build_file(reinterpret_cast<size_t>(target));
+    memory_module<winapi_posix> fresh;
+    check(fresh.map(at_target.data()) == memory_module<winapi_posix>::errc::ok && fresh.base_addr() == target, "fresh map at the target");
+    if (fresh.base_addr() == target) {
+        moved[bss_rva + 0x10] = 0;
+        check(image_of(target) == moved, "relocate_to matches a fresh map");
+    }
+    fresh.close();
+
+    // moving off large pages onto normal ones
+    memory_module<winapi_posix> large(winapi_posix(), alloc_policy::large_pages);
+    check(large.map(file.data()) == memory_module<winapi_posix>::errc::ok, "map on large pages");
+    // where they are had, nothing is protected or decommitted below their size, .reloc included
+    check(!large.large_pages() || protection_at(large.base_addr(), reloc_rva) == page::execute_readwrite, "large pages stay read-write-execute");
+    check(large.relocate_to(nullptr) == memory_module<winapi_posix>::errc::ok, "relocate_to from large pages");
+    check(!large.large_pages(), "normal pages after the move");
+    large.close();
+
+    check(posix::__regions().regions.empty(), "nothing left mapped");
+    return failures ? 1 : 0;
+}
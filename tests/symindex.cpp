@@ -0,0 +1,159 @@
+/**
+ *  symbol_index built from a synthetic loader list of mapped images: names exported by several modules,
+ *  forwarders, and modules removed and added again, with the slot of a removed module taken over.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include "petricks/rt-symindex.hpp"
+
+using namespace pe;
+using namespace pe::image;
+using namespace pe::runtime;
+using namespace pe::runtime::reflect;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (!ok) { fprintf(stderr, "failed: %s\n", what); ++failures; }
+}
+
+struct export_spec {
+    std::string name;
+    const char* forward_to; // nullptr for code
+}; // struct export_spec
+
+const u32 export_rva = 0x1000, code_rva = 0x8000;
+
+// a mapped image with nothing but headers and an export directory, names must be given sorted
+std::vector<u8> build_module(const char* dll_name, const std::vector<export_spec>& exports) {
+    std::vector<u8> image(0x10000, 0);
+    auto& doshdr = ref_at<dos_header>(image.data());
+    doshdr.e_magic = dos_signature;
+    doshdr.e_lfanew = 0x40;
+    auto& nthdr = doshdr.nthdr();
+    nthdr.Signature = nt_signature;
+    nthdr.FileHeader.Machine = u16(file_machine::local);
+    nthdr.FileHeader.SizeOfOptionalHeader = sizeof(optional_header);
+    auto& opthdr = nthdr.OptionalHeader.local;
+    opthdr.Magic = image_traits<optional_header>::magic;
+    opthdr.SizeOfImage = u32(image.size());
+    opthdr.SizeOfHeaders = 0x400;
+    opthdr.NumberOfRvaAndSizes = numberof_directory_entries;
+
+    u32 count = u32(exports.size());
+    u32 functions = export_rva + sizeof(export_directory);
+    u32 names = functions + 4 * count;
+    u32 ordinals = names + 4 * count;
+    u32 strings = ordinals + 2 * count;
+    auto add_string = [&](const char* text) {
+        u32 rva = strings;
+        memcpy(&image[rva], text, strlen(text) + 1);
+        strings += u32(strlen(text) + 1);
+        return rva;
+    };
+    auto& directory = ref_at<export_directory>(image.data(), export_rva);
+    directory.Name = add_string(dll_name);
+    directory.Base = 1;
+    directory.NumberOfFunctions = count;
+    directory.NumberOfNames = count;
+    directory.AddressOfFunctions = functions;
+    directory.AddressOfNames = names;
+    directory.AddressOfNameOrdinals = ordinals;
+    for (u32 i = 0; i < count; ++i) {
+        u32 name = add_string(exports[i].name.c_str());
+        // forwarders are strings inside the export directory, code is outside of it
+        u32 target = exports[i].forward_to ? add_string(exports[i].forward_to) : code_rva + i * 0x10;
+        memcpy(&image[functions + 4 * i], &target, 4);
+        memcpy(&image[names + 4 * i], &name, 4);
+        u16 ordinal = u16(i);
+        memcpy(&image[ordinals + 2 * i], &ordinal, 2);
+    }
+    opthdr.datadir(directory_entry::export_) = {export_rva, strings - export_rva};
+    return image;
+}
+
+struct fake_ldr {
+    peb::ldr_data data;
+    std::vector<ldr_data_table_entry> entries;
+
+    explicit fake_ldr(const std::vector<void*>& modules) : data(), entries(modules.size() + 1) {
+        auto& head = data.InLoadOrderModuleList;
+        head.Flink = head.Blink = &head;
+        // a last entry without a base, which the walk stops at
+        for (size_t i = 0; i < entries.size(); ++i) {
+            auto& links = entries[i].InLoadOrderLinks;
+            entries[i].DllBase = i < modules.size() ? modules[i] : nullptr;
+            links.Flink = &head;
+            links.Blink = head.Blink;
+            head.Blink->Flink = &links;
+            head.Blink = &links;
+        }
+    }
+}; // struct fake_ldr
+
+std::set<void*> exporters(const symbol_index& index, const char* name) {
+    std::set<void*> found;
+    index.find_all(name, [&](const symbol_index::symbol& sym) { found.insert(sym.module); });
+    return found;
+}
+
+} // namespace
+
+int main() {
+    std::vector<export_spec> many;
+    for (int i = 0; i < 200; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "Gamma%03d", i);
+        many.push_back({name, nullptr});
+    }
+    many.push_back({"Shared", nullptr});
+    auto alpha = build_module("alpha.dll", {{"Forwarded", "beta.OnlyBeta"}, {"OnlyAlpha", nullptr}, {"Shared", nullptr}});
+    auto beta = build_module("beta.dll", {{"OnlyBeta", nullptr}, {"Shared", nullptr}});
+    auto gamma = build_module("gamma.dll", many);
+    auto delta = build_module("delta.dll", {{"OnlyDelta", nullptr}, {"Shared", nullptr}});
+    void* a = alpha.data();
+    void* b = beta.data();
+    void* g = gamma.data();
+    void* d = delta.data();
+
+    symbol_index index;
+    fake_ldr ldr({a, b, g});
+    index.add_ldr_modules(&ldr.data);
+    check(index.module_count() == 3 && index.size() == 3 + 2 + 201, "every export of the loader list");
+
+    check(exporters(index, "Shared") == std::set<void*>{a, b, g}, "a name exported by every module");
+    auto only_beta = index.find("OnlyBeta");
+    check(only_beta.module == b && only_beta.rva == code_rva && !only_beta.forwarder, "find");
+    check(only_beta.address() == ptr_at<void>(b, code_rva), "address");
+    auto forwarded = index.find("Forwarded");
+    check(forwarded.module == a && forwarded.forwarder && !strcmp(ptr_at<char>(a, forwarded.rva), "beta.OnlyBeta"), "forwarder");
+    check(!index.find("OnlyBeta.dll") && !index.find("shared") && !index.find(""), "names are exact");
+    check(index.find("Gamma123").rva == code_rva + 123 * 0x10, "a module with many exports");
+
+    check(index.add_module(b) == 0 && index.size() == 206, "adding a module twice");
+    check(index.remove_module(d) == 0 && index.remove_module(nullptr) == 0, "removing a module not indexed");
+
+    check(index.remove_module(b) == 2 && index.module_count() == 2 && index.size() == 204, "remove_module");
+    check(!index.find("OnlyBeta"), "a removed module's own name");
+    check(exporters(index, "Shared") == std::set<void*>{a, g}, "a shared name after removing one exporter");
+    bool all_found = true;
+    for (int i = 0; i < 200; ++i) { all_found = all_found && index.find(string_view(many[i].name.c_str())).module == g; }
+    check(all_found, "other entries survive the removal");
+
+    // delta takes the slot beta left, nothing of beta may show up as delta's
+    check(index.add_module(d) == 2 && index.module_count() == 3, "add_module into a free slot");
+    check(!index.find("OnlyBeta") && index.find("OnlyDelta").module == d, "no stale entries in a reused slot");
+    check(exporters(index, "Shared") == std::set<void*>{a, g, d}, "a shared name after reuse");
+    check(index.add_module(b) == 2 && index.module_count() == 4 && index.find("OnlyBeta").module == b, "adding a removed module again");
+
+    check(index.remove_module(g) == 201 && index.remove_module(a) == 3, "removing the rest");
+    check(index.remove_module(d) == 2 && index.remove_module(b) == 2, "removing the rest");
+    check(index.size() == 0 && index.module_count() == 0 && !index.find("Shared"), "empty again");
+    return failures ? 1 : 0;
+}